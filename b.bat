@@ -1,6 +1,6 @@
 @echo off
 cls
-(gcc main.c init.c dpi_manager.c memory_manager.c -o a.exe -luser32 -lgdi32 -Werror -Wall -Wextra -pedantic -Wcast-align -Wcast-qual -Wdisabled-optimization -Wformat=2 -Winit-self -Wlogical-op -Wmissing-include-dirs -Wredundant-decls -Wshadow -Wundef -Wno-unused -Wno-variadic-macros -Wno-parentheses -fdiagnostics-show-option -Werror=vla -std=c99 -O0 || GOTO FAIL)
+(gcc main.c init.c dpi_manager.c memory_manager.c edit_manager.c file_indexer.c wrap_layout.c follow_mode.c diff_manager.c task_scheduler.c sort_manager.c input_trace.c editor_core.c -o a.exe -luser32 -lgdi32 -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -Werror -Wall -Wextra -pedantic -Wcast-align -Wcast-qual -Wdisabled-optimization -Wformat=2 -Winit-self -Wlogical-op -Wmissing-include-dirs -Wredundant-decls -Wshadow -Wundef -Wno-unused -Wno-variadic-macros -Wno-parentheses -fdiagnostics-show-option -Werror=vla -std=c99 -O0 || GOTO FAIL)
 echo Build is successful.
 EXIT /B
 
@@ -0,0 +1,575 @@
+#include <stdlib.h>
+#include <string.h>
+#include "diff_manager.h"
+#include "file_indexer.h"
+
+// Lines between the common prefix and the common suffix of both
+// documents. Identical lines share an identifier, so that the search
+// compares integers rather than text.
+typedef struct {
+    unsigned long *pOldArr;
+    unsigned long *pNewArr;
+    unsigned char *pOldChangedArr;
+    unsigned char *pNewChangedArr;
+} sDiffLines;
+
+// The state of one thread of the search. The furthest paths on
+// diagonal k live at index k+half, so memory grows with the number of
+// differences rather than with the number of lines.
+typedef struct {
+    const sDiffLines *pLines;
+    long *pForwardArr;
+    long *pBackwardArr;
+    long half;
+    long oldFirst, oldLast;     // Region that the thread diffs.
+    long newFirst, newLast;
+    unsigned int threads;       // Threads that the search may use.
+    enum EsError result;
+} sDiffSearch;
+
+// A slot of the identifier table. The first line with a text stands
+// for every line with the same text.
+typedef struct {
+    const sLine *pLine;
+    unsigned long hash;
+} sDiffIdentity;
+
+static int linesEqual(const sLine *pFirst, const sLine *pSecond);
+static unsigned long hashLine(const sLine *pLine);
+static void identifyLines(const sLineNode *pNode, unsigned long lines,
+    sDiffIdentity *pTableArr, unsigned long mask, unsigned long *pIdArr);
+static enum EsError diffRegion(sDiffSearch *pSearch, long oldFirst,
+    long oldLast, long newFirst, long newLast);
+static DWORD WINAPI diffBranch(LPVOID pParameter);
+static enum EsError findMiddleSnake(sDiffSearch *pSearch, long oldFirst,
+    long oldLast, long newFirst, long newLast, long *pOldSplit,
+    long *pNewSplit);
+static enum EsError reserveDiagonals(sDiffSearch *pSearch, long half);
+static enum EsError collectHunks(const sDiffLines *pLines,
+    unsigned long oldLines, unsigned long newLines, unsigned long prefix,
+    sDiff *pDiff);
+static enum EsError appendHunk(sDiff *pDiff, unsigned long oldFirstLineIndex,
+    unsigned long oldLines, unsigned long newFirstLineIndex,
+    unsigned long newLines);
+
+// Finds the hunks that turn the old deque into the new one. Lines that
+// both documents share at their start and end never reach the search.
+// The rest becomes integer identifiers, which the linear-space variant
+// of the O(ND) algorithm of Myers compares.
+enum EsError diffDeques(const sLineDeque *pOld, const sLineDeque *pNew,
+        sDiff *pDiff) {
+    
+    const sLineNode *pOldFirst = pOld->pHead, *pNewFirst = pNew->pHead;
+    const sLineNode *pOldLast = pOld->pTail, *pNewLast = pNew->pTail;
+    unsigned long prefix = 0, suffix = 0;
+    unsigned long oldLines, newLines, buckets = 1;
+    sDiffLines lines = { 0 };
+    sDiffIdentity *pTableArr;
+    sDiffSearch search = { 0 };
+    SYSTEM_INFO systemInfo;
+    enum EsError result;
+    
+    pDiff->hunks = pDiff->capacity = 0;
+    pDiff->pHunkArr = NULL;
+    
+    while (prefix < pOld->lines && prefix < pNew->lines
+            && linesEqual(&pOldFirst->line, &pNewFirst->line)) {
+        pOldFirst = pOldFirst->pNext;
+        pNewFirst = pNewFirst->pNext;
+        ++prefix;
+    }
+    while (suffix < pOld->lines - prefix && suffix < pNew->lines - prefix
+            && linesEqual(&pOldLast->line, &pNewLast->line)) {
+        pOldLast = pOldLast->pPrev;
+        pNewLast = pNewLast->pPrev;
+        ++suffix;
+    }
+    oldLines = pOld->lines - prefix - suffix;
+    newLines = pNew->lines - prefix - suffix;
+    
+    if (oldLines == 0 && newLines == 0) {
+        return ES_ERROR_SUCCESS;
+        
+    }
+    if (oldLines == 0 || newLines == 0) {
+        return appendHunk(pDiff, prefix, oldLines, prefix, newLines);
+        
+    }
+    
+    // Keep the table at most half full, so that probes stay short.
+    while (buckets < 2*(oldLines+newLines)) {
+        buckets <<= 1;
+    }
+    pTableArr = calloc(buckets, sizeof(sDiffIdentity));
+    lines.pOldArr = malloc(sizeof(unsigned long)*oldLines);
+    lines.pNewArr = malloc(sizeof(unsigned long)*newLines);
+    lines.pOldChangedArr = calloc(oldLines, sizeof(unsigned char));
+    lines.pNewChangedArr = calloc(newLines, sizeof(unsigned char));
+    if (pTableArr == NULL || lines.pOldArr == NULL || lines.pNewArr == NULL
+            || lines.pOldChangedArr == NULL
+            || lines.pNewChangedArr == NULL) {
+        result = ES_ERROR_ALLOCATION_FAIL;
+        
+    } else {
+        identifyLines(pOldFirst, oldLines, pTableArr, buckets-1, 
+            lines.pOldArr);
+        identifyLines(pNewFirst, newLines, pTableArr, buckets-1, 
+            lines.pNewArr);
+        
+        GetSystemInfo(&systemInfo);
+        search.pLines = &lines;
+        search.threads = systemInfo.dwNumberOfProcessors;
+        result = diffRegion(&search, 0, oldLines, 0, newLines);
+        free(search.pForwardArr);
+        free(search.pBackwardArr);
+        
+        if (result == ES_ERROR_SUCCESS) {
+            result = collectHunks(&lines, oldLines, newLines, prefix, 
+                pDiff);
+            
+        }
+    }
+    
+    free(pTableArr);
+    free(lines.pOldArr);
+    free(lines.pNewArr);
+    free(lines.pOldChangedArr);
+    free(lines.pNewChangedArr);
+    if (result != ES_ERROR_SUCCESS) {
+        destructDiff(pDiff);
+        
+    }
+    
+    return result;
+}
+
+// Diffs a deque against the current content of a file, which loads
+// into a deque of its own.
+enum EsError diffDequeWithFile(HANDLE hFile, const sLineDeque *pDeque,
+        sDiff *pDiff) {
+    
+    sLineDeque disk = { 0 };
+    sLineChain chain;
+    enum EsError result;
+    
+    // Interned lines carry the hash of their text.
+    result = indexFileIntoDeque(hFile, &disk, TRUE);
+    if (result == ES_ERROR_SUCCESS) {
+        result = diffDeques(&disk, pDeque, pDiff);
+        
+    }
+    
+    chain.pHead = disk.pHead;
+    chain.pTail = disk.pTail;
+    chain.lines = disk.lines;
+    destructLineChain(&chain);
+    
+    return result;
+}
+
+void destructDiff(sDiff *pDiff) {
+    free(pDiff->pHunkArr);
+    pDiff->pHunkArr = NULL;
+    pDiff->hunks = pDiff->capacity = 0;
+    return;
+}
+
+// Finds the first hunk that covers the line of the new document or
+// comes after it. A hunk that only removes lines covers the line that
+// follows the removed lines.
+unsigned long findDiffHunk(const sDiff *pDiff, unsigned long newLineIndex) {
+    
+    unsigned long low = 0, high = pDiff->hunks;
+    
+    while (low < high) {
+        const unsigned long middle = low + (high-low)/2;
+        const sDiffHunk *pHunk = pDiff->pHunkArr + middle;
+        const unsigned long lastLineIndex = pHunk->newFirstLineIndex
+            + (pHunk->newLines > 0 ? pHunk->newLines : 1);
+        
+        if (lastLineIndex <= newLineIndex) {
+            low = middle + 1;
+            
+        } else {
+            high = middle;
+            
+        }
+    }
+    
+    return low;
+}
+
+static int linesEqual(const sLine *pFirst, const sLine *pSecond) {
+    
+    // Lines that share a text block skip the comparison.
+    return pFirst->characters == pSecond->characters
+        && (LINE_TEXT(pFirst) == LINE_TEXT(pSecond)
+        || memcmp(LINE_TEXT(pFirst), LINE_TEXT(pSecond),
+        pFirst->characters) == 0);
+}
+
+// Interned lines already know the hash of their text block.
+static unsigned long hashLine(const sLine *pLine) {
+    
+    if (pLine->shared) {
+        return LINE_BLOCK(pLine)->hash;
+        
+    }
+    
+    return hashLineText(LINE_TEXT(pLine), pLine->characters);
+}
+
+// The identifier of a line is the slot of its text in the table.
+static void identifyLines(const sLineNode *pNode, unsigned long lines,
+        sDiffIdentity *pTableArr, unsigned long mask, unsigned long *pIdArr) {
+    
+    unsigned long lineIndex;
+    
+    for (lineIndex = 0; lineIndex < lines; ++lineIndex) {
+        const unsigned long hash = hashLine(&pNode->line);
+        unsigned long slot = hash & mask;
+        
+        while (pTableArr[slot].pLine != NULL
+                && (pTableArr[slot].hash != hash
+                || !linesEqual(pTableArr[slot].pLine, &pNode->line))) {
+            slot = (slot+1) & mask;
+        }
+        if (pTableArr[slot].pLine == NULL) {
+            pTableArr[slot].pLine = &pNode->line;
+            pTableArr[slot].hash = hash;
+            
+        }
+        
+        pIdArr[lineIndex] = slot;
+        pNode = pNode->pNext;
+    }
+    
+    return;
+}
+
+// Marks the changed lines of a region. The middle snake splits the
+// region into two regions with at most half the differences each, and
+// large regions hand one half to another thread.
+static enum EsError diffRegion(sDiffSearch *pSearch, long oldFirst,
+        long oldLast, long newFirst, long newLast) {
+    
+    const sDiffLines *pLines = pSearch->pLines;
+    long oldSplit, newSplit;
+    enum EsError result;
+    
+    while (oldFirst < oldLast && newFirst < newLast
+            && pLines->pOldArr[oldFirst] == pLines->pNewArr[newFirst]) {
+        ++oldFirst;
+        ++newFirst;
+    }
+    while (oldFirst < oldLast && newFirst < newLast
+            && pLines->pOldArr[oldLast-1] == pLines->pNewArr[newLast-1]) {
+        --oldLast;
+        --newLast;
+    }
+    
+    if (oldFirst == oldLast || newFirst == newLast) {
+        memset(pLines->pOldChangedArr + oldFirst, TRUE, oldLast-oldFirst);
+        memset(pLines->pNewChangedArr + newFirst, TRUE, newLast-newFirst);
+        return ES_ERROR_SUCCESS;
+        
+    }
+    
+    result = findMiddleSnake(pSearch, oldFirst, oldLast, newFirst, newLast,
+        &oldSplit, &newSplit);
+    if (result != ES_ERROR_SUCCESS) {
+        return result;
+        
+    }
+    
+    // Regions without a common line changed entirely.
+    if (oldSplit < 0) {
+        memset(pLines->pOldChangedArr + oldFirst, TRUE, oldLast-oldFirst);
+        memset(pLines->pNewChangedArr + newFirst, TRUE, newLast-newFirst);
+        return ES_ERROR_SUCCESS;
+        
+    }
+    
+    if (pSearch->threads > 1 && (oldLast-oldFirst) + (newLast-newFirst)
+            >= ES_DIFF_PARALLEL_LINES) {
+        sDiffSearch branch = { 0 };
+        HANDLE hThread;
+        
+        branch.pLines = pLines;
+        branch.oldFirst = oldFirst;
+        branch.oldLast = oldSplit;
+        branch.newFirst = newFirst;
+        branch.newLast = newSplit;
+        branch.threads = pSearch->threads / 2;
+        pSearch->threads -= branch.threads;
+        
+        // A branch without a thread runs on the calling thread.
+        hThread = CreateThread(NULL, 0, diffBranch, &branch, 0, NULL);
+        if (hThread == NULL) {
+            diffBranch(&branch);
+            
+        }
+        result = diffRegion(pSearch, oldSplit, oldLast, newSplit, newLast);
+        if (hThread != NULL) {
+            WaitForSingleObject(hThread, INFINITE);
+            CloseHandle(hThread);
+            
+        }
+        
+        pSearch->threads += branch.threads;
+        return result != ES_ERROR_SUCCESS ? result : branch.result;
+        
+    }
+    
+    result = diffRegion(pSearch, oldFirst, oldSplit, newFirst, newSplit);
+    if (result != ES_ERROR_SUCCESS) {
+        return result;
+        
+    }
+    
+    return diffRegion(pSearch, oldSplit, oldLast, newSplit, newLast);
+}
+
+static DWORD WINAPI diffBranch(LPVOID pParameter) {
+    
+    sDiffSearch *pBranch = pParameter;
+    
+    pBranch->result = diffRegion(pBranch, pBranch->oldFirst,
+        pBranch->oldLast, pBranch->newFirst, pBranch->newLast);
+    free(pBranch->pForwardArr);
+    free(pBranch->pBackwardArr);
+    
+    return 0;
+}
+
+// Walks the furthest paths from both corners of the region until they
+// overlap. The point of the overlap lies on an optimal path, so the
+// region splits there. A negative split means that no line matches.
+static enum EsError findMiddleSnake(sDiffSearch *pSearch, long oldFirst,
+        long oldLast, long newFirst, long newLast, long *pOldSplit,
+        long *pNewSplit) {
+    
+    const unsigned long *pOld = pSearch->pLines->pOldArr + oldFirst;
+    const unsigned long *pNew = pSearch->pLines->pNewArr + newFirst;
+    const long oldLines = oldLast - oldFirst, newLines = newLast - newFirst;
+    const long delta = oldLines - newLines;
+    const int odd = delta % 2 != 0;
+    const long maximumD = (oldLines + newLines + 1) / 2;
+    long forwardStart = 0, forwardEnd = 0;
+    long backwardStart = 0, backwardEnd = 0;
+    long diagonal, d;
+    
+    if (reserveDiagonals(pSearch, 1) != ES_ERROR_SUCCESS) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    // Earlier regions leave paths behind, but only the diagonals that
+    // this region can reach need a reset.
+    for (diagonal = -maximumD - 1; diagonal <= maximumD + 1; ++diagonal) {
+        if (diagonal >= -pSearch->half && diagonal <= pSearch->half) {
+            pSearch->pForwardArr[pSearch->half + diagonal] = -1;
+            pSearch->pBackwardArr[pSearch->half + diagonal] = -1;
+            
+        }
+    }
+    pSearch->pForwardArr[pSearch->half + 1] = 0;
+    pSearch->pBackwardArr[pSearch->half + 1] = 0;
+    
+    for (d = 0; d < maximumD; ++d) {
+        long *pForward, *pBackward;
+        
+        if (reserveDiagonals(pSearch, d + 1) != ES_ERROR_SUCCESS) {
+            return ES_ERROR_ALLOCATION_FAIL;
+            
+        }
+        pForward = pSearch->pForwardArr + pSearch->half;
+        pBackward = pSearch->pBackwardArr + pSearch->half;
+        
+        for (diagonal = -d + forwardStart; diagonal <= d - forwardEnd;
+                diagonal += 2) {
+            const long mirror = delta - diagonal;
+            long x, y;
+            
+            if (diagonal == -d || (diagonal != d
+                    && pForward[diagonal-1] < pForward[diagonal+1])) {
+                x = pForward[diagonal+1];
+                
+            } else {
+                x = pForward[diagonal-1] + 1;
+                
+            }
+            y = x - diagonal;
+            while (x < oldLines && y < newLines && pOld[x] == pNew[y]) {
+                ++x;
+                ++y;
+            }
+            pForward[diagonal] = x;
+            
+            // Paths that leave the region shrink the diagonals to walk.
+            if (x > oldLines) {
+                forwardEnd += 2;
+                
+            } else if (y > newLines) {
+                forwardStart += 2;
+                
+            } else if (odd && mirror >= -d && mirror <= d
+                    && pBackward[mirror] != -1
+                    && x >= oldLines - pBackward[mirror]) {
+                *pOldSplit = oldFirst + x;
+                *pNewSplit = newFirst + y;
+                return ES_ERROR_SUCCESS;
+                
+            }
+        }
+        
+        for (diagonal = -d + backwardStart; diagonal <= d - backwardEnd;
+                diagonal += 2) {
+            const long mirror = delta - diagonal;
+            long x, y;
+            
+            if (diagonal == -d || (diagonal != d
+                    && pBackward[diagonal-1] < pBackward[diagonal+1])) {
+                x = pBackward[diagonal+1];
+                
+            } else {
+                x = pBackward[diagonal-1] + 1;
+                
+            }
+            y = x - diagonal;
+            while (x < oldLines && y < newLines
+                    && pOld[oldLines-x-1] == pNew[newLines-y-1]) {
+                ++x;
+                ++y;
+            }
+            pBackward[diagonal] = x;
+            
+            if (x > oldLines) {
+                backwardEnd += 2;
+                
+            } else if (y > newLines) {
+                backwardStart += 2;
+                
+            } else if (!odd && mirror >= -d && mirror <= d
+                    && pForward[mirror] != -1
+                    && pForward[mirror] >= oldLines - x) {
+                *pOldSplit = oldFirst + pForward[mirror];
+                *pNewSplit = newFirst + pForward[mirror] - mirror;
+                return ES_ERROR_SUCCESS;
+                
+            }
+        }
+    }
+    
+    *pOldSplit = *pNewSplit = -1;
+    return ES_ERROR_SUCCESS;
+}
+
+// Makes room for the diagonals from -half to half. New diagonals hold
+// no path yet.
+static enum EsError reserveDiagonals(sDiffSearch *pSearch, long half) {
+    
+    long *pForwardArr, *pBackwardArr;
+    long grownHalf = pSearch->half > 0 ? pSearch->half
+        : ES_DIFF_INITIAL_DIAGONALS;
+    long diagonal;
+    
+    if (half <= pSearch->half && pSearch->pForwardArr != NULL) {
+        return ES_ERROR_SUCCESS;
+        
+    }
+    while (grownHalf < half) {
+        grownHalf *= 2;
+    }
+    
+    pForwardArr = malloc(sizeof(long)*(2*grownHalf+1));
+    pBackwardArr = malloc(sizeof(long)*(2*grownHalf+1));
+    if (pForwardArr == NULL || pBackwardArr == NULL) {
+        free(pForwardArr);
+        free(pBackwardArr);
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    for (diagonal = -grownHalf; diagonal <= grownHalf; ++diagonal) {
+        const int kept = pSearch->pForwardArr != NULL
+            && diagonal >= -pSearch->half && diagonal <= pSearch->half;
+        
+        pForwardArr[grownHalf + diagonal] = kept
+            ? pSearch->pForwardArr[pSearch->half + diagonal] : -1;
+        pBackwardArr[grownHalf + diagonal] = kept
+            ? pSearch->pBackwardArr[pSearch->half + diagonal] : -1;
+    }
+    
+    free(pSearch->pForwardArr);
+    free(pSearch->pBackwardArr);
+    pSearch->pForwardArr = pForwardArr;
+    pSearch->pBackwardArr = pBackwardArr;
+    pSearch->half = grownHalf;
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Unchanged lines pair up in order, so every run of changed lines
+// between two pairs forms a hunk.
+static enum EsError collectHunks(const sDiffLines *pLines,
+        unsigned long oldLines, unsigned long newLines, unsigned long prefix,
+        sDiff *pDiff) {
+    
+    unsigned long oldIndex = 0, newIndex = 0;
+    
+    while (oldIndex < oldLines || newIndex < newLines) {
+        const unsigned long oldStart = oldIndex, newStart = newIndex;
+        
+        while (oldIndex < oldLines && pLines->pOldChangedArr[oldIndex]) {
+            ++oldIndex;
+        }
+        while (newIndex < newLines && pLines->pNewChangedArr[newIndex]) {
+            ++newIndex;
+        }
+        
+        if (oldIndex > oldStart || newIndex > newStart) {
+            if (appendHunk(pDiff, prefix + oldStart, oldIndex - oldStart,
+                    prefix + newStart, newIndex - newStart)
+                    != ES_ERROR_SUCCESS) {
+                return ES_ERROR_ALLOCATION_FAIL;
+                
+            }
+        } else {
+            ++oldIndex;
+            ++newIndex;
+            
+        }
+    }
+    
+    return ES_ERROR_SUCCESS;
+}
+
+static enum EsError appendHunk(sDiff *pDiff, unsigned long oldFirstLineIndex,
+        unsigned long oldLines, unsigned long newFirstLineIndex,
+        unsigned long newLines) {
+    
+    sDiffHunk *pHunk;
+    
+    if (pDiff->hunks == pDiff->capacity) {
+        const unsigned long capacity = pDiff->capacity*2 + 16;
+        sDiffHunk *pHunkArr = realloc(pDiff->pHunkArr,
+            sizeof(sDiffHunk)*capacity);
+        
+        if (pHunkArr == NULL) {
+            return ES_ERROR_ALLOCATION_FAIL;
+            
+        }
+        pDiff->pHunkArr = pHunkArr;
+        pDiff->capacity = capacity;
+        
+    }
+    
+    pHunk = pDiff->pHunkArr + pDiff->hunks++;
+    pHunk->oldFirstLineIndex = oldFirstLineIndex;
+    pHunk->oldLines = oldLines;
+    pHunk->newFirstLineIndex = newFirstLineIndex;
+    pHunk->newLines = newLines;
+    
+    return ES_ERROR_SUCCESS;
+}
@@ -0,0 +1,36 @@
+#include "memory_manager.h"
+
+#ifndef _HEADER_DIFF_MANAGER
+
+// Regions with fewer lines stay on the thread that found them, since
+// starting a thread costs more than diffing them.
+#define ES_DIFF_PARALLEL_LINES (64*1024)
+// Diagonals that a search reserves before it needs more.
+#define ES_DIFF_INITIAL_DIAGONALS 64
+
+// A hunk replaces lines of the old document with lines of the new
+// document. Hunks that only insert or only remove lines leave the
+// other side empty.
+typedef struct {
+    unsigned long oldFirstLineIndex;
+    unsigned long oldLines;
+    unsigned long newFirstLineIndex;
+    unsigned long newLines;
+} sDiffHunk;
+
+// Hunks in the order of the lines of both documents.
+typedef struct Diff {
+    unsigned long hunks;
+    unsigned long capacity;
+    sDiffHunk *pHunkArr;
+} sDiff;
+
+enum EsError diffDeques(const sLineDeque *pOld, const sLineDeque *pNew,
+    sDiff *pDiff);
+enum EsError diffDequeWithFile(HANDLE hFile, const sLineDeque *pDeque,
+    sDiff *pDiff);
+void destructDiff(sDiff *pDiff);
+unsigned long findDiffHunk(const sDiff *pDiff, unsigned long newLineIndex);
+
+#define _HEADER_DIFF_MANAGER
+#endif
\ No newline at end of file
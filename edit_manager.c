@@ -0,0 +1,1244 @@
+#include <stdlib.h>
+#include <string.h>
+#include "edit_manager.h"
+#include "file_indexer.h"
+
+#define SALLOC(s) (malloc(sizeof(s)))
+
+// Storage for text that grows while a batch walks the line deque.
+typedef struct {
+    char *pStart;
+    size_t characters;
+    size_t capacity;
+} sTextBuffer;
+
+// Original lines of a group of edits and the lines that replace them.
+typedef struct {
+    sLineNode *pFirst;
+    sLineNode *pLast;
+    unsigned long firstLineIndex;
+    unsigned long lines;
+    sLineNode *pNewHead;
+    sLineNode *pNewTail;
+    unsigned long newLines;
+} sEditGroup;
+
+static int appendText(sTextBuffer *pBuffer, const char *pText,
+    size_t characters);
+static int comparePositions(unsigned long lineA, unsigned int characterA,
+    unsigned long lineB, unsigned int characterB);
+static sLineNode *buildLineChain(const char *pText, size_t characters,
+    sLineNode **ppTail, unsigned long *pLines);
+static enum EsError applyEdits(sLineDeque *pDeque, const sEdit *pEdits,
+    unsigned long edits, sDamage *pDamage, sUndoEntry **ppInverse);
+static enum EsError restoreLineOrder(sLineDeque *pDeque, 
+    sUndoEntry *pEntry, sDamage *pDamage);
+static enum EsError spliceLines(sLineDeque *pDeque, 
+    const sWriteHead *pFirst, const sWriteHead *pLast, sClip *pInsert, 
+    int moveInsert, sClip **ppRemoved, sUndoEntry **ppInverse, 
+    sDamage *pDamage);
+static int clampRange(const sWriteHead *pFirst, const sWriteHead *pLast,
+    unsigned int *pFirstIndex, unsigned int *pLastIndex);
+static void appendRunToChain(sLineChain *pChain, sLineNode *pHead,
+    sLineNode *pTail, unsigned long lines);
+static sLineNode *findLineNode(const sLineDeque *pDeque, 
+    unsigned long lineIndex);
+static void destructUndoEntry(sUndoEntry *pEntry);
+
+enum EsError applyEditBatch(sLineDeque *pDeque, const sEdit *pEdits,
+        unsigned long edits, sDamage *pDamage) {
+    
+    sUndoEntry *pEntry;
+    enum EsError result = applyEdits(pDeque, pEdits, edits, pDamage,
+        &pEntry);
+    
+    if (result != ES_ERROR_SUCCESS || pEntry == NULL) {
+        return result;
+        
+    }
+    
+    // The whole batch constitutes a single step in the history.
+    pushUndoEntry(pDeque, pEntry);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+enum EsError undoEditBatch(sLineDeque *pDeque, sDamage *pDamage) {
+    
+    sUndoEntry *pEntry = pDeque->pUndoHistory;
+    enum EsError result;
+    
+    if (pEntry == NULL) {
+        return ES_ERROR_NOTHING_TO_UNDO;
+        
+    }
+    
+    switch (pEntry->kind) {
+        case ES_UNDO_ORDER: {
+            result = restoreLineOrder(pDeque, pEntry, pDamage);
+            break;
+        }
+        case ES_UNDO_SNAPSHOT: {
+            result = restoreDequeSnapshot(pDeque, pEntry->hSnapshot, 
+                pDamage);
+            break;
+        }
+        case ES_UNDO_SPLICE: {
+            const sEdit *pRange = &pEntry->range;
+            sWriteHead first, last;
+            
+            // The range names lines of the document that the splice
+            // left behind. Another document has no such lines.
+            if (pRange->firstLineIndex > pRange->lastLineIndex
+                    || pRange->lastLineIndex >= pDeque->lines) {
+                result = ES_ERROR_INVALID_EDIT;
+                break;
+                
+            }
+            first.pNode = findLineNode(pDeque, pRange->firstLineIndex);
+            first.lineIndex = pRange->firstLineIndex;
+            first.characterIndex = pRange->firstCharacterIndex;
+            last.pNode = findLineNode(pDeque, pRange->lastLineIndex);
+            last.lineIndex = pRange->lastLineIndex;
+            last.characterIndex = pRange->lastCharacterIndex;
+            
+            // Nothing else holds a clip that the clipboard let go of,
+            // so its lines move back without copies. The clipboard
+            // keeps spares of its own clip, which move back instead.
+            result = spliceLines(pDeque, &first, &last, pEntry->pClip,
+                pEntry->pClip != NULL && pEntry->pClip->references == 1,
+                NULL, NULL, pDamage);
+            break;
+        }
+        default: {
+            result = applyEdits(pDeque, pEntry->pEdits, pEntry->edits, 
+                pDamage, NULL);
+            break;
+        }
+    }
+    if (result != ES_ERROR_SUCCESS) {
+        return result;
+        
+    }
+    
+    pDeque->pUndoHistory = pEntry->pPrev;
+    destructUndoEntry(pEntry);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+enum EsError replaceAllInDeque(sLineDeque *pDeque, const char *pPattern,
+        unsigned int patternCharacters, const char *pReplacement,
+        unsigned int replacementCharacters, sDamage *pDamage) {
+    
+    sEdit *pEdits = NULL;
+    unsigned long edits = 0, capacity = 0, lineIndex = 0;
+    const sLineNode *pNode;
+    enum EsError result;
+    
+    // Patterns never match across lines.
+    if (patternCharacters == 0
+            || memchr(pPattern, '\n', patternCharacters) != NULL) {
+        return ES_ERROR_INVALID_EDIT;
+        
+    }
+    
+    // Gather every match in document order. The order already
+    // satisfies the requirements of a batch.
+    for (pNode = pDeque->pHead; pNode != NULL;
+            pNode = pNode->pNext, ++lineIndex) {
+        
+        unsigned int characterIndex = 0;
+        
+        while (characterIndex + patternCharacters
+                <= pNode->line.characters) {
+            
+            if (memcmp(LINE_TEXT(&pNode->line)+characterIndex, pPattern,
+                    patternCharacters) != 0) {
+                ++characterIndex;
+                continue;
+                
+            }
+            
+            if (edits == capacity) {
+                sEdit *pGrown;
+                
+                capacity = capacity*2 + 16;
+                pGrown = realloc(pEdits, sizeof(sEdit)*capacity);
+                if (pGrown == NULL) {
+                    free(pEdits);
+                    return ES_ERROR_ALLOCATION_FAIL;
+                    
+                }
+                pEdits = pGrown;
+                
+            }
+            
+            pEdits[edits].firstLineIndex = lineIndex;
+            pEdits[edits].firstCharacterIndex = characterIndex;
+            pEdits[edits].lastLineIndex = lineIndex;
+            pEdits[edits].lastCharacterIndex = characterIndex
+                + patternCharacters;
+            pEdits[edits].pReplacement = pReplacement;
+            pEdits[edits].replacementCharacters = replacementCharacters;
+            ++edits;
+            
+            // Matches never overlap.
+            characterIndex += patternCharacters;
+        }
+    }
+    
+    result = applyEditBatch(pDeque, pEdits, edits, pDamage);
+    free(pEdits);
+    
+    return result;
+}
+
+// Captures the text between two positions as a clip. The lines in
+// between share their text with the document, so only the lines at
+// both ends copy characters.
+enum EsError copyDequeRange(const sWriteHead *pFirst, 
+        const sWriteHead *pLast, sClip **ppClip) {
+    
+    const sLine *pFirstLine = &pFirst->pNode->line;
+    const sLine *pLastLine = &pLast->pNode->line;
+    unsigned int firstIndex, lastIndex;
+    sLineNode *pNode, *pCopy;
+    sClip *pClip;
+    
+    *ppClip = NULL;
+    if (!clampRange(pFirst, pLast, &firstIndex, &lastIndex)) {
+        return ES_ERROR_INVALID_EDIT;
+        
+    }
+    
+    pClip = constructClip();
+    if (pClip == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    if (pFirst->pNode == pLast->pNode) {
+        pCopy = constructJoinedLineNode(LINE_TEXT(pFirstLine)+firstIndex,
+            lastIndex-firstIndex, "", 0, "", 0);
+        if (pCopy == NULL) {
+            goto allocationFail;
+            
+        }
+        appendNodeToChain(pCopy, &pClip->lines);
+        
+    } else {
+        pCopy = constructJoinedLineNode(LINE_TEXT(pFirstLine)+firstIndex,
+            pFirstLine->characters-firstIndex, "", 0, "", 0);
+        if (pCopy == NULL) {
+            goto allocationFail;
+            
+        }
+        appendNodeToChain(pCopy, &pClip->lines);
+        
+        for (pNode = pFirst->pNode->pNext; pNode != pLast->pNode;
+                pNode = pNode->pNext) {
+            pCopy = constructSharedLineNode(pNode);
+            if (pCopy == NULL) {
+                goto allocationFail;
+                
+            }
+            appendNodeToChain(pCopy, &pClip->lines);
+        }
+        
+        pCopy = constructJoinedLineNode(LINE_TEXT(pLastLine), lastIndex,
+            "", 0, "", 0);
+        if (pCopy == NULL) {
+            goto allocationFail;
+            
+        }
+        appendNodeToChain(pCopy, &pClip->lines);
+        
+    }
+    
+    *ppClip = pClip;
+    return ES_ERROR_SUCCESS;
+    
+    allocationFail:
+    releaseClip(pClip);
+    return ES_ERROR_ALLOCATION_FAIL;
+}
+
+// Replaces the text between two positions with the text of a clip, or
+// removes it without one. The removed text becomes a clip when the
+// caller asks for it. Lines move in and out of the deque as a whole,
+// so the splice rebuilds only the lines at both ends. The lines of the
+// inserted clip stay in the clip, and the deque takes their spares or
+// copies that share their text. The write head
+// ends after the inserted text. The splice is a single undo step.
+enum EsError spliceDequeRange(sLineDeque *pDeque, const sWriteHead *pFirst,
+        const sWriteHead *pLast, sClip *pInsert, sClip **ppRemoved,
+        sDamage *pDamage) {
+    
+    sUndoEntry *pEntry;
+    enum EsError result = spliceLines(pDeque, pFirst, pLast, pInsert, 
+        FALSE, ppRemoved, &pEntry, pDamage);
+    
+    if (result != ES_ERROR_SUCCESS) {
+        return result;
+        
+    }
+    
+    pushUndoEntry(pDeque, pEntry);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Makes the entry the next step that an undo reverts.
+void pushUndoEntry(sLineDeque *pDeque, sUndoEntry *pEntry) {
+    pEntry->pPrev = pDeque->pUndoHistory;
+    pDeque->pUndoHistory = pEntry;
+    return;
+}
+
+void clearUndoHistory(sLineDeque *pDeque) {
+    while (pDeque->pUndoHistory != NULL) {
+        sUndoEntry *pEntry = pDeque->pUndoHistory;
+        pDeque->pUndoHistory = pEntry->pPrev;
+        destructUndoEntry(pEntry);
+    }
+    return;
+}
+
+// Replaces every line with the lines of a snapshot of the document.
+// The current lines stay until the snapshot loaded in full. The write
+// head returns to the first line.
+enum EsError restoreDequeSnapshot(sLineDeque *pDeque, HANDLE hSnapshot,
+        sDamage *pDamage) {
+    
+    const unsigned long previousLines = pDeque->lines;
+    sLineDeque snapshot = { 0 };
+    sLineChain chain;
+    enum EsError result = indexFileIntoDeque(hSnapshot, &snapshot, TRUE);
+    
+    if (result != ES_ERROR_SUCCESS) {
+        chain.pHead = snapshot.pHead;
+        chain.pTail = snapshot.pTail;
+        chain.lines = snapshot.lines;
+        destructLineChain(&chain);
+        return result;
+        
+    }
+    
+    chain.pHead = pDeque->pHead;
+    chain.pTail = pDeque->pTail;
+    chain.lines = pDeque->lines;
+    destructLineChain(&chain);
+    
+    pDeque->pHead = snapshot.pHead;
+    pDeque->pTail = snapshot.pTail;
+    pDeque->lines = snapshot.lines;
+    
+    pDeque->writeHead.pNode = pDeque->pHead;
+    pDeque->writeHead.lineIndex = 0;
+    pDeque->writeHead.characterIndex = 0;
+    
+    pDamage->firstLineIndex = 0;
+    pDamage->lastLineIndex = pDeque->lines - 1;
+    pDamage->lineDelta = (signed long) pDeque->lines 
+        - (signed long) previousLines;
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Applies sorted, non-overlapping edits in a single pass over the
+// deque. Edits that share a line form a group. The pass rebuilds the
+// lines of each group once and records the inverse of every edit,
+// unless the caller has no use for it. Every group has its new lines
+// before the deque changes, so a failed batch leaves the deque as it
+// was.
+static enum EsError applyEdits(sLineDeque *pDeque, const sEdit *pEdits,
+        unsigned long edits, sDamage *pDamage, sUndoEntry **ppInverse) {
+    
+    sTextBuffer lines = { 0 };          // New text of a group.
+    sTextBuffer removed = { 0 };        // Text that edits remove.
+    sEdit *pInverse = NULL;             // Edits that undo the batch.
+    size_t *pRemovedOffsets = NULL;     // Offsets into removed text.
+    sEditGroup *pGroupArr;              // Lines that each group spans.
+    sUndoEntry *pEntry = NULL;          // Compound undo entry.
+    sLineNode *pNode;                   // Node at the line index.
+    unsigned long lineIndex;            // Line before the batch.
+    signed long lineDelta = 0;          // Lines that the batch added.
+    unsigned long editIndex, groups = 0, groupIndex;
+    
+    // Track the write head since the batch may destroy its node.
+    // The index remains relative to the lines before the batch until
+    // the pass reaches it.
+    unsigned long headLineIndex = pDeque->writeHead.lineIndex;
+    int headPlaced = FALSE;
+    
+    if (ppInverse != NULL) {
+        *ppInverse = NULL;
+        
+    }
+    pDamage->firstLineIndex = pDamage->lastLineIndex = 0;
+    pDamage->lineDelta = 0;
+    
+    // Reject edits out of order, overlapping or outside the deque.
+    for (editIndex = 0; editIndex < edits; ++editIndex) {
+        const sEdit *pEdit = pEdits + editIndex;
+        
+        if (pEdit->lastLineIndex >= pDeque->lines
+                || comparePositions(pEdit->firstLineIndex,
+                pEdit->firstCharacterIndex, pEdit->lastLineIndex,
+                pEdit->lastCharacterIndex) > 0
+                || (editIndex > 0 && comparePositions(
+                pEdit[-1].lastLineIndex, pEdit[-1].lastCharacterIndex,
+                pEdit->firstLineIndex, pEdit->firstCharacterIndex) > 0)) {
+            return ES_ERROR_INVALID_EDIT;
+            
+        }
+    }
+    
+    if (edits == 0) {
+        return ES_ERROR_SUCCESS;
+        
+    }
+    
+    pGroupArr = malloc(sizeof(sEditGroup)*edits);
+    if (pGroupArr == NULL) {
+        goto allocationFail;
+        
+    }
+    if (ppInverse != NULL) {
+        pInverse = malloc(sizeof(sEdit)*edits);
+        pRemovedOffsets = malloc(sizeof(size_t)*edits);
+        pEntry = SALLOC(sUndoEntry);
+        if (pInverse == NULL || pRemovedOffsets == NULL || pEntry == NULL) {
+            goto allocationFail;
+            
+        }
+    }
+    
+    // Start from the node nearest to the first edit, so that an edit
+    // at the write head costs the same anywhere in the document.
+    lineIndex = pEdits[0].firstLineIndex;
+    pNode = findLineNode(pDeque, lineIndex);
+    
+    editIndex = 0;
+    while (editIndex < edits) {
+        sEditGroup *pGroup = pGroupArr + groups;
+        const unsigned long groupFirstLineIndex =
+            pEdits[editIndex].firstLineIndex;
+        unsigned long outputLineIndex;
+        unsigned int cursorIndex = 0;   // Character index in the node.
+        size_t outputLineStart = 0;     // Start of the output line.
+        
+        while (lineIndex < groupFirstLineIndex) {
+            pNode = pNode->pNext;
+            ++lineIndex;
+        }
+        
+        pGroup->pFirst = pNode;
+        pGroup->firstLineIndex = groupFirstLineIndex;
+        outputLineIndex = groupFirstLineIndex + lineDelta;
+        lines.characters = 0;
+        
+        // Assemble the new text of the group. The group continues as
+        // long as the next edit starts on the line where the previous
+        // edit ended.
+        do {
+            const sEdit *pEdit = pEdits + editIndex;
+            sEdit undo;                 // Inverse of the edit.
+            size_t removedStart;        // Start of its removed text.
+            unsigned int firstIndex = pEdit->firstCharacterIndex;
+            unsigned int lastIndex;
+            unsigned int replacementIndex;
+            
+            // Clamp positions past the end of a line to its end.
+            if (firstIndex > pNode->line.characters) {
+                firstIndex = pNode->line.characters;
+                
+            }
+            if (firstIndex < cursorIndex) {
+                firstIndex = cursorIndex;
+                
+            }
+            
+            // Keep the original text before the edit.
+            if (!appendText(&lines, LINE_TEXT(&pNode->line)+cursorIndex,
+                    firstIndex-cursorIndex)) {
+                goto allocationFail;
+                
+            }
+            
+            undo.firstLineIndex = outputLineIndex;
+            undo.firstCharacterIndex = lines.characters
+                - outputLineStart;
+            
+            if (!appendText(&lines, pEdit->pReplacement,
+                    pEdit->replacementCharacters)) {
+                goto allocationFail;
+                
+            }
+            
+            // Line feed characters in the replacement open new lines.
+            for (replacementIndex = 0;
+                    replacementIndex < pEdit->replacementCharacters;
+                    ++replacementIndex) {
+                if (pEdit->pReplacement[replacementIndex] == '\n') {
+                    ++outputLineIndex;
+                    outputLineStart = lines.characters
+                        - pEdit->replacementCharacters
+                        + replacementIndex + 1;
+                    
+                }
+            }
+            
+            undo.lastLineIndex = outputLineIndex;
+            undo.lastCharacterIndex = lines.characters
+                - outputLineStart;
+            
+            // Remember the text that the edit removes so that undoing
+            // the batch can restore it.
+            removedStart = removed.characters;
+            cursorIndex = firstIndex;
+            while (lineIndex < pEdit->lastLineIndex) {
+                if (pInverse != NULL && (!appendText(&removed,
+                        LINE_TEXT(&pNode->line)+cursorIndex,
+                        pNode->line.characters-cursorIndex)
+                        || !appendText(&removed, "\n", 1))) {
+                    goto allocationFail;
+                    
+                }
+                
+                pNode = pNode->pNext;
+                ++lineIndex;
+                cursorIndex = 0;
+            }
+            
+            lastIndex = pEdit->lastCharacterIndex;
+            if (lastIndex > pNode->line.characters) {
+                lastIndex = pNode->line.characters;
+                
+            }
+            if (lastIndex < cursorIndex) {
+                lastIndex = cursorIndex;
+                
+            }
+            
+            if (pInverse != NULL && !appendText(&removed,
+                    LINE_TEXT(&pNode->line)+cursorIndex,
+                    lastIndex-cursorIndex)) {
+                goto allocationFail;
+                
+            }
+            undo.replacementCharacters = removed.characters - removedStart;
+            if (pInverse != NULL) {
+                pInverse[editIndex] = undo;
+                pRemovedOffsets[editIndex] = removedStart;
+                
+            }
+            
+            cursorIndex = lastIndex;
+            ++editIndex;
+        } while (editIndex < edits
+            && pEdits[editIndex].firstLineIndex == lineIndex);
+        
+        // Keep the original text after the last edit of the group.
+        if (!appendText(&lines, LINE_TEXT(&pNode->line)+cursorIndex,
+                pNode->line.characters-cursorIndex)) {
+            goto allocationFail;
+            
+        }
+        
+        pGroup->pLast = pNode;
+        pGroup->lines = lineIndex - groupFirstLineIndex + 1;
+        pGroup->pNewHead = buildLineChain(lines.pStart, lines.characters,
+            &pGroup->pNewTail, &pGroup->newLines);
+        if (pGroup->pNewHead == NULL) {
+            goto allocationFail;
+            
+        }
+        ++groups;
+        lineDelta += (signed long) pGroup->newLines 
+            - (signed long) pGroup->lines;
+        
+        // Continue after the group with the original lines.
+        pNode = pNode->pNext;
+        ++lineIndex;
+    }
+    
+    // Splice the rebuilt lines in place of the original lines. Each
+    // group links to the lines around it as they are by then, which
+    // includes the new lines of the group before it.
+    lineDelta = 0;
+    for (groupIndex = 0; groupIndex < groups; ++groupIndex) {
+        const sEditGroup *pGroup = pGroupArr + groupIndex;
+        const unsigned long groupLastLineIndex = pGroup->firstLineIndex
+            + pGroup->lines - 1;
+        sLineNode *pOld = pGroup->pFirst;
+        sLineNode *pAfter = pGroup->pLast->pNext;
+        
+        pGroup->pNewHead->pPrev = pGroup->pFirst->pPrev;
+        pGroup->pNewTail->pNext = pAfter;
+        if (pGroup->pFirst->pPrev == NULL) {
+            pDeque->pHead = pGroup->pNewHead;
+            
+        } else {
+            pGroup->pFirst->pPrev->pNext = pGroup->pNewHead;
+            
+        }
+        if (pAfter == NULL) {
+            pDeque->pTail = pGroup->pNewTail;
+            
+        } else {
+            pAfter->pPrev = pGroup->pNewTail;
+            
+        }
+        
+        // Move the write head along with the text it points to. The
+        // first group at or past the write head decides its line.
+        if (!headPlaced && headLineIndex <= groupLastLineIndex) {
+            if (headLineIndex >= pGroup->firstLineIndex) {
+                unsigned long offset = headLineIndex 
+                    - pGroup->firstLineIndex;
+                sLineNode *pHeadNode = pGroup->pNewHead;
+                
+                if (offset >= pGroup->newLines) {
+                    offset = pGroup->newLines - 1;
+                    
+                }
+                headLineIndex = pGroup->firstLineIndex + offset;
+                while (offset--) pHeadNode = pHeadNode->pNext;
+                pDeque->writeHead.pNode = pHeadNode;
+                
+            }
+            headLineIndex += lineDelta;
+            headPlaced = TRUE;
+            
+        }
+        
+        // The damage spans from the first group to the last group.
+        if (groupIndex == 0) {
+            pDamage->firstLineIndex = pGroup->firstLineIndex;
+            
+        }
+        pDamage->lastLineIndex = pGroup->firstLineIndex + lineDelta
+            + pGroup->newLines - 1;
+        
+        lineDelta += (signed long) pGroup->newLines 
+            - (signed long) pGroup->lines;
+        pDeque->lines += pGroup->newLines - pGroup->lines;
+        
+        while (pOld != pAfter) {
+            sLineNode *pNext = pOld->pNext;
+            destructLineNode(pOld);
+            pOld = pNext;
+        }
+    }
+    
+    if (!headPlaced) {
+        headLineIndex += lineDelta;
+        
+    }
+    pDeque->writeHead.lineIndex = headLineIndex;
+    if (pDeque->writeHead.characterIndex
+            > pDeque->writeHead.pNode->line.characters) {
+        pDeque->writeHead.characterIndex =
+            pDeque->writeHead.pNode->line.characters;
+        
+    }
+    
+    pDamage->lineDelta = lineDelta;
+    
+    free(lines.pStart);
+    free(pGroupArr);
+    if (ppInverse == NULL) {
+        return ES_ERROR_SUCCESS;
+        
+    }
+    
+    // The replacements of the inverse edits point into the removed
+    // text, which no longer moves.
+    for (editIndex = 0; editIndex < edits; ++editIndex) {
+        pInverse[editIndex].pReplacement = removed.pStart == NULL ? ""
+            : removed.pStart + pRemovedOffsets[editIndex];
+    }
+    pEntry->pPrev = NULL;
+    pEntry->kind = ES_UNDO_EDITS;
+    pEntry->edits = edits;
+    pEntry->pEdits = pInverse;
+    pEntry->pText = removed.pStart;
+    free(pRemovedOffsets);
+    
+    *ppInverse = pEntry;
+    return ES_ERROR_SUCCESS;
+    
+    allocationFail:
+    for (groupIndex = 0; groupIndex < groups; ++groupIndex) {
+        sLineNode *pNew = pGroupArr[groupIndex].pNewHead;
+        
+        while (pNew != NULL) {
+            sLineNode *pNext = pNew->pNext;
+            destructLineNode(pNew);
+            pNew = pNext;
+        }
+    }
+    free(lines.pStart);
+    free(removed.pStart);
+    free(pInverse);
+    free(pRemovedOffsets);
+    free(pGroupArr);
+    free(pEntry);
+    return ES_ERROR_ALLOCATION_FAIL;
+}
+
+// Relinks the lines that a sort or a filter moved back into their
+// earlier order. The removed lines return at their indices among the
+// current lines first. Each node then moves to its earlier index. The
+// write head returns to the first line. An edit that changed the count
+// of lines since the order makes the indices meaningless, so the order
+// refuses to run.
+static enum EsError restoreLineOrder(sLineDeque *pDeque, 
+        sUndoEntry *pEntry, sDamage *pDamage) {
+    
+    const unsigned long previousLines = pDeque->lines;
+    const unsigned long lines = previousLines + pEntry->removed.lines;
+    sLineNode **pNodeArr = NULL;
+    sLineNode *pKept = pDeque->pHead;
+    sLineNode *pRemoved = pEntry->removed.pHead;
+    sLineChain chain = { 0 };
+    unsigned long lineIndex, removedIndex = 0;
+    
+    if (lines != pEntry->lines) {
+        return ES_ERROR_INVALID_EDIT;
+        
+    }
+    
+    if (pEntry->pOrderArr != NULL) {
+        pNodeArr = malloc(sizeof(sLineNode *)*lines);
+        if (pNodeArr == NULL) {
+            return ES_ERROR_ALLOCATION_FAIL;
+            
+        }
+    }
+    
+    for (lineIndex = 0; lineIndex < lines; ++lineIndex) {
+        sLineNode *pNode;
+        
+        if (removedIndex < pEntry->removed.lines
+                && pEntry->pRemovedIndexArr[removedIndex] == lineIndex) {
+            pNode = pRemoved;
+            pRemoved = pRemoved->pNext;
+            ++removedIndex;
+            
+        } else {
+            pNode = pKept;
+            pKept = pKept->pNext;
+            
+        }
+        
+        if (pNodeArr != NULL) {
+            pNodeArr[pEntry->pOrderArr[lineIndex]] = pNode;
+            
+        } else {
+            appendNodeToChain(pNode, &chain);
+            
+        }
+    }
+    
+    if (pNodeArr != NULL) {
+        for (lineIndex = 0; lineIndex < lines; ++lineIndex) {
+            appendNodeToChain(pNodeArr[lineIndex], &chain);
+        }
+        free(pNodeArr);
+        
+    }
+    
+    // The nodes of the removed chain belong to the deque again.
+    pEntry->removed.pHead = pEntry->removed.pTail = NULL;
+    pEntry->removed.lines = 0;
+    
+    pDeque->pHead = pDeque->pTail = NULL;
+    pDeque->lines = 0;
+    appendChainToDeque(&chain, pDeque);
+    
+    pDeque->writeHead.pNode = pDeque->pHead;
+    pDeque->writeHead.lineIndex = 0;
+    pDeque->writeHead.characterIndex = 0;
+    
+    pDamage->firstLineIndex = 0;
+    pDamage->lastLineIndex = lines - 1;
+    pDamage->lineDelta = (signed long) lines - (signed long) previousLines;
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Puts the lines of a clip in place of the text between two positions.
+// The first line of the clip continues the text before the first
+// position, and the text after the last position continues the last
+// line of the clip. The lines in between of the clip move into the
+// deque when the caller gives them away. Otherwise their spares move
+// in, and only the lines without a spare yet are copied, sharing their
+// text. Every allocation happens before the deque changes.
+static enum EsError spliceLines(sLineDeque *pDeque, 
+        const sWriteHead *pFirst, const sWriteHead *pLast, sClip *pInsert, 
+        int moveInsert, sClip **ppRemoved, sUndoEntry **ppInverse, 
+        sDamage *pDamage) {
+    
+    // Copy the positions, since either may be the write head.
+    const sWriteHead first = *pFirst, last = *pLast;
+    const sLine *pFirstLine = &first.pNode->line;
+    const sLine *pLastLine = &last.pNode->line;
+    const unsigned long removedBreaks = last.lineIndex - first.lineIndex;
+    const int keepRemoved = ppRemoved != NULL || ppInverse != NULL;
+    const char *pInsertFirstText = "", *pInsertLastText = "";
+    unsigned int insertFirstCharacters = 0, insertLastCharacters = 0;
+    unsigned long insertedLines = 1;
+    unsigned int firstIndex, lastIndex;
+    sLineChain added = { 0 };           // Lines that enter the deque.
+    sLineChain middle = { 0 };          // Shared lines of the clip.
+    sLineNode *pJoinedFirst = NULL, *pJoinedLast = NULL;
+    sLineNode *pCutFirst = NULL, *pCutLast = NULL;
+    sLineNode *pBefore, *pAfter, *pNode;
+    sClip *pRemoved = NULL;
+    sUndoEntry *pEntry = NULL;
+    
+    if (ppRemoved != NULL) {
+        *ppRemoved = NULL;
+        
+    }
+    if (ppInverse != NULL) {
+        *ppInverse = NULL;
+        
+    }
+    if (!clampRange(pFirst, pLast, &firstIndex, &lastIndex)) {
+        return ES_ERROR_INVALID_EDIT;
+        
+    }
+    
+    if (pInsert != NULL && pInsert->lines.lines > 0) {
+        pInsertFirstText = LINE_TEXT(&pInsert->lines.pHead->line);
+        insertFirstCharacters = pInsert->lines.pHead->line.characters;
+        pInsertLastText = LINE_TEXT(&pInsert->lines.pTail->line);
+        insertLastCharacters = pInsert->lines.pTail->line.characters;
+        insertedLines = pInsert->lines.lines;
+        
+    }
+    
+    // Rebuild the lines at both ends of the inserted text.
+    if (insertedLines == 1) {
+        pJoinedFirst = constructJoinedLineNode(LINE_TEXT(pFirstLine), 
+            firstIndex, pInsertFirstText, insertFirstCharacters, 
+            LINE_TEXT(pLastLine)+lastIndex, 
+            pLastLine->characters-lastIndex);
+        
+    } else {
+        pJoinedFirst = constructJoinedLineNode(LINE_TEXT(pFirstLine), 
+            firstIndex, pInsertFirstText, insertFirstCharacters, "", 0);
+        pJoinedLast = constructJoinedLineNode("", 0, pInsertLastText, 
+            insertLastCharacters, LINE_TEXT(pLastLine)+lastIndex, 
+            pLastLine->characters-lastIndex);
+        if (pJoinedLast == NULL) {
+            goto allocationFail;
+            
+        }
+    }
+    if (pJoinedFirst == NULL) {
+        goto allocationFail;
+        
+    }
+    if (insertedLines > 2 && !moveInsert) {
+        for (pNode = findNextSpareSource(pInsert); 
+                pNode != pInsert->lines.pTail; pNode = pNode->pNext) {
+            sLineNode *pShared = constructSharedLineNode(pNode);
+            
+            if (pShared == NULL) {
+                goto allocationFail;
+                
+            }
+            appendNodeToChain(pShared, &middle);
+        }
+    }
+    
+    // Rebuild the lines at both ends of the removed text.
+    if (keepRemoved) {
+        if (removedBreaks == 0) {
+            pCutFirst = constructJoinedLineNode(
+                LINE_TEXT(pFirstLine)+firstIndex, lastIndex-firstIndex, 
+                "", 0, "", 0);
+            
+        } else {
+            pCutFirst = constructJoinedLineNode(
+                LINE_TEXT(pFirstLine)+firstIndex, 
+                pFirstLine->characters-firstIndex, "", 0, "", 0);
+            pCutLast = constructJoinedLineNode(LINE_TEXT(pLastLine), 
+                lastIndex, "", 0, "", 0);
+            if (pCutLast == NULL) {
+                goto allocationFail;
+                
+            }
+        }
+        
+        pRemoved = constructClip();
+        if (ppInverse != NULL) {
+            pEntry = SALLOC(sUndoEntry);
+            if (pEntry == NULL) {
+                goto allocationFail;
+                
+            }
+        }
+        if (pCutFirst == NULL || pRemoved == NULL) {
+            goto allocationFail;
+            
+        }
+    }
+    
+    pBefore = first.pNode->pPrev;
+    pAfter = last.pNode->pNext;
+    
+    // The lines in between leave the deque without visits, unless they
+    // have nowhere to go.
+    if (keepRemoved) {
+        appendNodeToChain(pCutFirst, &pRemoved->lines);
+        if (removedBreaks > 1) {
+            appendRunToChain(&pRemoved->lines, first.pNode->pNext, 
+                last.pNode->pPrev, removedBreaks - 1);
+            
+        }
+        if (pCutLast != NULL) {
+            appendNodeToChain(pCutLast, &pRemoved->lines);
+            
+        }
+        
+    } else if (removedBreaks > 1) {
+        sLineChain discarded = { 0 };
+        
+        appendRunToChain(&discarded, first.pNode->pNext, 
+            last.pNode->pPrev, removedBreaks - 1);
+        destructLineChain(&discarded);
+        
+    }
+    
+    appendNodeToChain(pJoinedFirst, &added);
+    if (insertedLines > 2 && moveInsert) {
+        sLineChain *pLines = &pInsert->lines;
+        
+        appendRunToChain(&added, pLines->pHead->pNext, 
+            pLines->pTail->pPrev, insertedLines - 2);
+        pLines->pHead->pNext = pLines->pTail;
+        pLines->pTail->pPrev = pLines->pHead;
+        pLines->lines = 2;
+        
+    } else if (insertedLines > 2) {
+        
+        // The spares of the clip move in ahead of the lines that the
+        // splice copied after them.
+        if (pInsert->spare.lines > 0) {
+            appendRunToChain(&added, pInsert->spare.pHead, 
+                pInsert->spare.pTail, pInsert->spare.lines);
+            pInsert->spare.pHead = pInsert->spare.pTail = NULL;
+            pInsert->spare.lines = 0;
+            
+        }
+        if (middle.lines > 0) {
+            appendRunToChain(&added, middle.pHead, middle.pTail, 
+                middle.lines);
+            
+        }
+        pInsert->pNextSpare = NULL;
+        
+    }
+    if (pJoinedLast != NULL) {
+        appendNodeToChain(pJoinedLast, &added);
+        
+    }
+    if (moveInsert && pInsert != NULL) {
+        discardClipSpare(pInsert);
+        destructLineChain(&pInsert->lines);
+        
+    }
+    
+    // Splice the new lines in place of the lines at both ends.
+    added.pHead->pPrev = pBefore;
+    added.pTail->pNext = pAfter;
+    if (pBefore == NULL) {
+        pDeque->pHead = added.pHead;
+        
+    } else {
+        pBefore->pNext = added.pHead;
+        
+    }
+    if (pAfter == NULL) {
+        pDeque->pTail = added.pTail;
+        
+    } else {
+        pAfter->pPrev = added.pTail;
+        
+    }
+    pDeque->lines += insertedLines;
+    pDeque->lines -= removedBreaks + 1;
+    
+    destructLineNode(first.pNode);
+    if (last.pNode != first.pNode) {
+        destructLineNode(last.pNode);
+        
+    }
+    
+    pDeque->writeHead.pNode = added.pTail;
+    pDeque->writeHead.lineIndex = first.lineIndex + insertedLines - 1;
+    pDeque->writeHead.characterIndex = insertedLines == 1 
+        ? firstIndex + insertFirstCharacters : insertLastCharacters;
+    
+    pDamage->firstLineIndex = first.lineIndex;
+    pDamage->lastLineIndex = pDeque->writeHead.lineIndex;
+    pDamage->lineDelta = (signed long) insertedLines - 1 
+        - (signed long) removedBreaks;
+    
+    // Undoing the splice puts the removed text in place of the
+    // inserted text.
+    if (pEntry != NULL) {
+        pEntry->pPrev = NULL;
+        pEntry->kind = ES_UNDO_SPLICE;
+        pEntry->range.firstLineIndex = first.lineIndex;
+        pEntry->range.firstCharacterIndex = firstIndex;
+        pEntry->range.lastLineIndex = pDeque->writeHead.lineIndex;
+        pEntry->range.lastCharacterIndex = 
+            pDeque->writeHead.characterIndex;
+        pEntry->range.pReplacement = NULL;
+        pEntry->range.replacementCharacters = 0;
+        pEntry->pClip = pRemoved;
+        *ppInverse = pEntry;
+        if (ppRemoved != NULL) {
+            InterlockedIncrement(&pRemoved->references);
+            
+        }
+    }
+    if (ppRemoved != NULL) {
+        *ppRemoved = pRemoved;
+        
+    }
+    
+    return ES_ERROR_SUCCESS;
+    
+    allocationFail:
+    if (pJoinedFirst != NULL) {
+        destructLineNode(pJoinedFirst);
+        
+    }
+    if (pJoinedLast != NULL) {
+        destructLineNode(pJoinedLast);
+        
+    }
+    if (pCutFirst != NULL) {
+        destructLineNode(pCutFirst);
+        
+    }
+    if (pCutLast != NULL) {
+        destructLineNode(pCutLast);
+        
+    }
+    destructLineChain(&middle);
+    releaseClip(pRemoved);
+    free(pEntry);
+    return ES_ERROR_ALLOCATION_FAIL;
+}
+
+// Clamps positions past the end of a line to its end. Returns zero
+// when the last position comes before the first one.
+static int clampRange(const sWriteHead *pFirst, const sWriteHead *pLast,
+        unsigned int *pFirstIndex, unsigned int *pLastIndex) {
+    
+    *pFirstIndex = pFirst->characterIndex;
+    if (*pFirstIndex > pFirst->pNode->line.characters) {
+        *pFirstIndex = pFirst->pNode->line.characters;
+        
+    }
+    *pLastIndex = pLast->characterIndex;
+    if (*pLastIndex > pLast->pNode->line.characters) {
+        *pLastIndex = pLast->pNode->line.characters;
+        
+    }
+    
+    if (pFirst->lineIndex == pLast->lineIndex) {
+        return pFirst->pNode == pLast->pNode && *pFirstIndex <= *pLastIndex;
+        
+    }
+    return pFirst->lineIndex < pLast->lineIndex 
+        && pFirst->pNode != pLast->pNode;
+}
+
+// Moves linked nodes to the end of a chain without visiting them.
+static void appendRunToChain(sLineChain *pChain, sLineNode *pHead,
+        sLineNode *pTail, unsigned long lines) {
+    
+    pHead->pPrev = pChain->pTail;
+    if (pChain->pTail == NULL) {
+        pChain->pHead = pHead;
+        
+    } else {
+        pChain->pTail->pNext = pHead;
+        
+    }
+    pTail->pNext = NULL;
+    pChain->pTail = pTail;
+    pChain->lines += lines;
+    
+    return;
+}
+
+// Walks to a line from the nearest of the first line, the last line
+// and the write head.
+static sLineNode *findLineNode(const sLineDeque *pDeque, 
+        unsigned long lineIndex) {
+    
+    const unsigned long headLineIndex = pDeque->writeHead.lineIndex;
+    const unsigned long fromHead = headLineIndex > lineIndex 
+        ? headLineIndex - lineIndex : lineIndex - headLineIndex;
+    sLineNode *pNode;
+    unsigned long nodeLineIndex;
+    
+    if (lineIndex <= fromHead) {
+        pNode = pDeque->pHead;
+        nodeLineIndex = 0;
+        
+    } else if (pDeque->lines - 1 - lineIndex <= fromHead) {
+        pNode = pDeque->pTail;
+        nodeLineIndex = pDeque->lines - 1;
+        
+    } else {
+        pNode = pDeque->writeHead.pNode;
+        nodeLineIndex = headLineIndex;
+        
+    }
+    
+    while (nodeLineIndex < lineIndex) {
+        pNode = pNode->pNext;
+        ++nodeLineIndex;
+    }
+    while (nodeLineIndex > lineIndex) {
+        pNode = pNode->pPrev;
+        --nodeLineIndex;
+    }
+    
+    return pNode;
+}
+
+// Splits text at line feed characters into a chain of new nodes.
+static sLineNode *buildLineChain(const char *pText, size_t characters,
+        sLineNode **ppTail, unsigned long *pLines) {
+    
+    sLineNode *pHead = NULL, *pTail = NULL;
+    size_t lineStart = 0, characterIndex;
+    
+    *pLines = 0;
+    for (characterIndex = 0; characterIndex <= characters;
+            ++characterIndex) {
+        sLineNode *pNode;
+        
+        if (characterIndex < characters
+                && pText[characterIndex] != '\n') {
+            continue;
+            
+        }
+        
+        pNode = constructLineNode(characterIndex - lineStart);
+        if (pNode == NULL) {
+            while (pHead != NULL) {
+                sLineNode *pNext = pHead->pNext;
+                destructLineNode(pHead);
+                pHead = pNext;
+            }
+            return NULL;
+            
+        }
+        memcpy(LINE_TEXT(&pNode->line), pText+lineStart,
+            sizeof(char)*(characterIndex - lineStart));
+        
+        pNode->pPrev = pTail;
+        pNode->pNext = NULL;
+        if (pTail == NULL) {
+            pHead = pNode;
+            
+        } else {
+            pTail->pNext = pNode;
+            
+        }
+        pTail = pNode;
+        ++(*pLines);
+        
+        lineStart = characterIndex + 1;
+    }
+    
+    *ppTail = pTail;
+    return pHead;
+}
+
+static int appendText(sTextBuffer *pBuffer, const char *pText,
+        size_t characters) {
+    
+    if (characters == 0) {
+        return TRUE;
+        
+    }
+    
+    if (pBuffer->characters + characters > pBuffer->capacity) {
+        size_t capacity = pBuffer->capacity*2 + characters;
+        char *pGrown = realloc(pBuffer->pStart, sizeof(char)*capacity);
+        
+        if (pGrown == NULL) {
+            return FALSE;
+            
+        }
+        pBuffer->pStart = pGrown;
+        pBuffer->capacity = capacity;
+        
+    }
+    
+    memcpy(pBuffer->pStart+pBuffer->characters, pText,
+        sizeof(char)*characters);
+    pBuffer->characters += characters;
+    
+    return TRUE;
+}
+
+static int comparePositions(unsigned long lineA, unsigned int characterA,
+        unsigned long lineB, unsigned int characterB) {
+    if (lineA != lineB) {
+        return lineA < lineB ? -1 : 1;
+        
+    }
+    if (characterA != characterB) {
+        return characterA < characterB ? -1 : 1;
+        
+    }
+    return 0;
+}
+
+static void destructUndoEntry(sUndoEntry *pEntry) {
+    if (pEntry == NULL) {
+        return;
+        
+    }
+    switch (pEntry->kind) {
+        case ES_UNDO_ORDER: {
+            free(pEntry->pOrderArr);
+            free(pEntry->pRemovedIndexArr);
+            destructLineChain(&pEntry->removed);
+            break;
+        }
+        case ES_UNDO_SNAPSHOT: {
+            
+            // Closing the snapshot deletes its temporary file.
+            CloseHandle(pEntry->hSnapshot);
+            break;
+        }
+        case ES_UNDO_SPLICE: {
+            releaseClip(pEntry->pClip);
+            break;
+        }
+        default: {
+            free(pEntry->pText);
+            free(pEntry->pEdits);
+            break;
+        }
+    }
+    free(pEntry);
+    return;
+}
@@ -0,0 +1,73 @@
+#include "memory_manager.h"
+
+#ifndef _HEADER_EDIT_MANAGER
+
+// An edit replaces the characters from the first position up to, but
+// excluding, the last position. Line feed characters in the
+// replacement split the line.
+typedef struct {
+    unsigned long firstLineIndex;
+    unsigned int firstCharacterIndex;
+    unsigned long lastLineIndex;
+    unsigned int lastCharacterIndex;
+    const char *pReplacement;
+    unsigned int replacementCharacters;
+} sEdit;
+
+// Lines that a batch rebuilt, in the coordinates after the batch. A
+// non-zero line delta shifts every line below the damage.
+typedef struct {
+    unsigned long firstLineIndex;
+    unsigned long lastLineIndex;
+    signed long lineDelta;
+} sDamage;
+
+// Edits restore the text of a batch. An order restores lines that a
+// sort or a filter moved or removed without copying their text. A
+// snapshot reloads the whole document from a temporary file. A splice
+// puts the lines of a clip back in place of the lines that a cut or a
+// paste inserted.
+enum EsUndoKind {
+    ES_UNDO_EDITS,
+    ES_UNDO_ORDER,
+    ES_UNDO_SNAPSHOT,
+    ES_UNDO_SPLICE,
+};
+
+// A compound undo entry holds the inverse of a whole batch. Undoing an
+// order first puts the removed lines back at their indices and then
+// moves each line to its earlier index, unless the order is missing.
+// An order only undoes the document that it recorded the lines of.
+typedef struct UndoEntry {
+    struct UndoEntry *pPrev;
+    enum EsUndoKind kind;
+    unsigned long edits;
+    sEdit *pEdits;
+    char *pText;
+    unsigned long *pOrderArr;           // Earlier index of each line.
+    unsigned long lines;                // Lines before an order.
+    sLineChain removed;
+    unsigned long *pRemovedIndexArr;    // Index of each removed line.
+    HANDLE hSnapshot;
+    sEdit range;                        // Text that a splice inserted.
+    sClip *pClip;                       // Text that a splice removed.
+} sUndoEntry;
+
+enum EsError applyEditBatch(sLineDeque *pDeque, const sEdit *pEdits,
+    unsigned long edits, sDamage *pDamage);
+enum EsError undoEditBatch(sLineDeque *pDeque, sDamage *pDamage);
+enum EsError replaceAllInDeque(sLineDeque *pDeque, const char *pPattern,
+    unsigned int patternCharacters, const char *pReplacement,
+    unsigned int replacementCharacters, sDamage *pDamage);
+enum EsError restoreDequeSnapshot(sLineDeque *pDeque, HANDLE hSnapshot,
+    sDamage *pDamage);
+enum EsError copyDequeRange(const sWriteHead *pFirst, 
+    const sWriteHead *pLast, sClip **ppClip);
+enum EsError spliceDequeRange(sLineDeque *pDeque, const sWriteHead *pFirst,
+    const sWriteHead *pLast, sClip *pInsert, sClip **ppRemoved,
+    sDamage *pDamage);
+void pushUndoEntry(sLineDeque *pDeque, sUndoEntry *pEntry);
+void clearUndoHistory(sLineDeque *pDeque);
+
+#define _HEADER_EDIT_MANAGER
+#endif
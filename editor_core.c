@@ -0,0 +1,1343 @@
+#include <stdlib.h>
+#include <string.h>
+#include "editor_core.h"
+#include "memory_manager.h"
+#include "edit_manager.h"
+#include "wrap_layout.h"
+#include "diff_manager.h"
+#include "sort_manager.h"
+
+static sRepaint repaintWholeView(void);
+static unsigned long countVisibleRows(const sEditorCore *pCore);
+static RECT updateHighlight(sEditorState* pEditorState,
+    const unsigned short windowWidth,
+    const unsigned short curRelativeIndex);
+static void jumpHead(sEditorState *pState, const RECT *pRefreshRectangle);
+static RECT rectangleFromDamage(sEditorState *pEditorState,
+    const sDamage *pDamage, const unsigned short windowWidth,
+    const unsigned short windowHeight);
+static void moveHeadToLine(sEditorState *pState, unsigned long lineIndex);
+static void scrollWrappedView(sEditorState *pState, signed long rows);
+static void placeWrappedHighlight(sEditorState *pState);
+static void pinViewToBottom(sEditorState *pState,
+    unsigned long visibleRows);
+static void showReorderedDeque(sEditorCore *pCore,
+    unsigned long previousLines);
+static void scheduleWrapResolving(sEditorCore *pCore);
+static RECT showDamage(sEditorCore *pCore, const sDamage *pDamage);
+static void extendSelection(sEditorState *pState, int shift);
+static void replaceClipboard(sEditorCore *pCore, sClip *pClip);
+static void scheduleClipSpare(sEditorCore *pCore);
+static char *joinClipText(const sClip *pClip, unsigned int *pCharacters);
+static unsigned short wrapColumns(const unsigned short windowWidth);
+
+void constructEditorCore(sEditorCore *pCore, sTaskScheduler *pScheduler) {
+    
+    memset(&pCore->state, 0, sizeof(sEditorState));
+    pCore->state.internLines = ES_INTERN_LINES;
+    pCore->pScheduler = pScheduler;
+    pCore->width = pCore->height = 0;
+    pCore->following = FALSE;
+    
+    return;
+}
+
+void destructEditorCore(sEditorCore *pCore) {
+    
+    sEditorState *pState = &pCore->state;
+    
+    if (pCore->following) {
+        stopFollowing(&pCore->follower);
+        pCore->following = FALSE;
+        
+    }
+    
+    /*XXX: Go to each deque and free its nodes!!!! Then free
+    the array.*/
+    if (pState->dequeArr == NULL) {
+        return;
+        
+    }
+    clearUndoHistory(pState->dequeArr);
+    replaceClipboard(pCore, NULL);
+    if (pState->pDiff != NULL) {
+        destructDiff(pState->pDiff);
+        free(pState->pDiff);
+        pState->pDiff = NULL;
+        
+    }
+    if (pState->pWrapLayout != NULL) {
+        cancelTasks(pCore->pScheduler, pState->pWrapLayout);
+        destructWrapLayout(pState->pWrapLayout);
+        free(pState->pWrapLayout);
+        pState->pWrapLayout = NULL;
+        
+    }
+    // Let go of the file, which a replay deletes afterwards.
+    if (pState->dequeArr[0].hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(pState->dequeArr[0].hFile);
+        
+    }
+    free(pState->dequeArr);
+    pState->dequeArr = NULL;
+    
+    return;
+}
+
+enum EsError openEditorDocument(sEditorCore *pCore, const char *pPath) {
+    
+    const enum EsError result = loadFileIntoEditorState(pPath,
+        &pCore->state);
+    
+    if (result != ES_ERROR_SUCCESS) {
+        return result;
+        
+    }
+    
+    /*XXX: Consider multiple open files.*/
+    pCore->state.pActiveHead = &(pCore->state.dequeArr[0].writeHead);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Streams text from a pipe into an empty document.
+enum EsError followEditorInput(sEditorCore *pCore, HANDLE hSource) {
+    
+    enum EsError result = loadEmptyIntoEditorState(&pCore->state);
+    
+    if (result != ES_ERROR_SUCCESS) {
+        return result;
+        
+    }
+    pCore->state.pActiveHead = &(pCore->state.dequeArr[0].writeHead);
+    
+    result = startFollowing(&pCore->follower, hSource,
+        pCore->state.dequeArr, ES_FOLLOW_MAXIMUM_LINES);
+    pCore->following = result == ES_ERROR_SUCCESS;
+    
+    return result;
+}
+
+// A new width moves the wrap points of every line.
+void resizeEditor(sEditorCore *pCore, unsigned short width,
+        unsigned short height) {
+    
+    pCore->width = width;
+    pCore->height = height;
+    if (pCore->state.pWrapLayout != NULL) {
+        resizeWrapLayout(pCore->state.pWrapLayout, wrapColumns(width));
+        scheduleWrapResolving(pCore);
+        
+    }
+    
+    return;
+}
+
+// Handles a key press. Keys along with the Control key run commands on
+// the document.
+sRepaint pressEditorKey(sEditorCore *pCore, WPARAM key,
+        unsigned int modifiers) {
+    
+    sEditorState *pState = &pCore->state;
+    const int control = (modifiers & ES_MODIFIER_CONTROL) != 0;
+    const int shift = (modifiers & ES_MODIFIER_SHIFT) != 0;
+    const int selecting = pState->selecting;
+    sRepaint repaint = { FALSE, FALSE, { 0, 0, 0, 0 }, TRUE };
+    RECT refreshRectangle;
+    
+    switch (key) {
+        
+        case VK_RETURN: {
+            sWriteHead *pHead = pState->pActiveHead;
+            sEdit lineBreak;
+            sDamage damage;
+            
+            // Open an empty line below the line of the write
+            // head, as a step that an undo reverts. Following
+            // replaces the last line with each batch.
+            if (pCore->following) {
+                return repaint;
+                
+            }
+            lineBreak.firstLineIndex = pHead->lineIndex;
+            lineBreak.firstCharacterIndex = 
+                pHead->pNode->line.characters;
+            lineBreak.lastLineIndex = lineBreak.firstLineIndex;
+            lineBreak.lastCharacterIndex = 
+                lineBreak.firstCharacterIndex;
+            lineBreak.pReplacement = "\n";
+            lineBreak.replacementCharacters = 1;
+            if (applyEditBatch(pState->dequeArr, &lineBreak, 1,
+                    &damage) != ES_ERROR_SUCCESS) {
+                return repaint;
+                
+            }
+            
+            pHead->pNode = pHead->pNode->pNext;
+            ++(pHead->lineIndex);
+            pHead->characterIndex = 0;
+            pState->selecting = FALSE;
+            
+            refreshRectangle = showDamage(pCore, &damage);
+            break;
+        }
+        
+        case VK_BACK: {
+            sWriteHead *pHead = pState->pActiveHead;
+            sEdit lineJoin;
+            sDamage damage;
+            
+            // Remove an empty line along with the line break
+            // before it. The write head moves up a line.
+            if (pHead->pNode->line.characters != 0
+                    || pHead->pNode->pPrev == NULL || pCore->following) {
+                return repaint;
+                
+            }
+            lineJoin.firstLineIndex = pHead->lineIndex - 1;
+            lineJoin.firstCharacterIndex = 
+                pHead->pNode->pPrev->line.characters;
+            lineJoin.lastLineIndex = pHead->lineIndex;
+            lineJoin.lastCharacterIndex = 0;
+            lineJoin.pReplacement = "";
+            lineJoin.replacementCharacters = 0;
+            if (applyEditBatch(pState->dequeArr, &lineJoin, 1,
+                    &damage) != ES_ERROR_SUCCESS) {
+                return repaint;
+                
+            }
+            pState->selecting = FALSE;
+            
+            refreshRectangle = showDamage(pCore, &damage);
+            break;
+        }
+        
+        case VK_UP: {
+            
+            extendSelection(pState, 
+                shift);
+            if (pState->pActiveHead->pNode->pPrev != NULL) {
+                
+                pState->pActiveHead->pNode = 
+                    pState->pActiveHead->pNode->pPrev;
+                refreshRectangle = updateHighlight(pState, 
+                    pCore->width, 
+                    pState->curHighlight.relativeFocusLineIndex
+                    - 1);
+                break;
+                
+            }
+            return repaint;
+        }
+        case VK_DOWN: {
+            
+            extendSelection(pState, 
+                shift);
+            if (pState->pActiveHead->pNode->pNext != NULL) {
+                
+                pState->pActiveHead->pNode = 
+                    pState->pActiveHead->pNode->pNext;
+                refreshRectangle = updateHighlight(pState, 
+                    pCore->width, 
+                    pState->curHighlight.relativeFocusLineIndex
+                    + 1);
+                break;
+            }
+            return repaint;
+        }
+        
+        // Move the write head along its line. Nothing but the
+        // selection shows where it stands within the line.
+        case VK_LEFT:
+        case VK_RIGHT: {
+            sWriteHead *pHead = pState->pActiveHead;
+            const unsigned int characters = 
+                pHead->pNode->line.characters;
+            
+            extendSelection(pState, 
+                shift);
+            if (pHead->characterIndex > characters) {
+                pHead->characterIndex = characters;
+                
+            }
+            if (key == VK_LEFT && pHead->characterIndex > 0) {
+                --(pHead->characterIndex);
+                
+            } else if (key == VK_RIGHT 
+                    && pHead->characterIndex < characters) {
+                ++(pHead->characterIndex);
+                
+            }
+            
+            if (selecting || pState->selecting) {
+                return repaintWholeView();
+                
+            }
+            return repaint;
+        }
+        
+        case 'Z': {
+            sDamage damage;
+            
+            // Undo the last batch of edits as a single step.
+            // The follower replaces lines that undo entries of
+            // the meantime would refer to.
+            if (!control || pCore->following
+                    || undoEditBatch(pState->dequeArr, &damage)
+                    != ES_ERROR_SUCCESS) {
+                return repaint;
+                
+            }
+            pState->selecting = FALSE;
+            
+            // Undoing a cut may have taken the spares of the clipboard.
+            scheduleClipSpare(pCore);
+            
+            refreshRectangle = showDamage(pCore, &damage);
+            break;
+        }
+        
+        case 'C': {
+            const sWriteHead *pFirst, *pLast;
+            sClip *pClip;
+            
+            // Copy the selection. Lines in the middle of it share
+            // their text with the document.
+            if (!control 
+                    || !pState->selecting) {
+                return repaint;
+                
+            }
+            orderSelection(pState, &pFirst, &pLast);
+            if (copyDequeRange(pFirst, pLast, &pClip) 
+                    != ES_ERROR_SUCCESS) {
+                return repaint;
+                
+            }
+            
+            replaceClipboard(pCore, pClip);
+            return repaint;
+        }
+        
+        case 'X': {
+            const sWriteHead *pFirst, *pLast;
+            sClip *pRemoved;
+            sDamage damage;
+            
+            // Cut the selection. Its lines leave the document
+            // without copies, and the undo shares them with the
+            // clipboard. Following relies on the last line.
+            if (!control 
+                    || !pState->selecting || pCore->following) {
+                return repaint;
+                
+            }
+            orderSelection(pState, &pFirst, &pLast);
+            if (spliceDequeRange(pState->dequeArr, pFirst, pLast,
+                    NULL, &pRemoved, &damage) != ES_ERROR_SUCCESS) {
+                return repaint;
+                
+            }
+            
+            replaceClipboard(pCore, pRemoved);
+            pState->selecting = FALSE;
+            
+            refreshRectangle = showDamage(pCore, &damage);
+            break;
+        }
+        
+        case 'V': {
+            const sWriteHead *pFirst = pState->pActiveHead;
+            const sWriteHead *pLast = pState->pActiveHead;
+            sDamage damage;
+            
+            // Paste the clipboard at the write head, or over the
+            // selection, as a single step to undo.
+            if (!control 
+                    || pState->pClipboard == NULL || pCore->following) {
+                return repaint;
+                
+            }
+            if (pState->selecting) {
+                orderSelection(pState, &pFirst, &pLast);
+                
+            }
+            if (spliceDequeRange(pState->dequeArr, pFirst, pLast,
+                    pState->pClipboard, NULL, &damage) 
+                    != ES_ERROR_SUCCESS) {
+                return repaint;
+                
+            }
+            pState->selecting = FALSE;
+            
+            // The paste took the spares, so copy them again for the
+            // next one.
+            scheduleClipSpare(pCore);
+            
+            refreshRectangle = showDamage(pCore, &damage);
+            break;
+        }
+        
+        case 'R': {
+            const sUndoEntry *pPreviousStep = 
+                pState->dequeArr[0].pUndoHistory;
+            const sWriteHead *pFirst, *pLast;
+            const sLine *pLine;
+            unsigned int firstIndex, lastIndex;
+            unsigned int replacementCharacters;
+            char *pReplacement;
+            sDamage damage;
+            enum EsError result;
+            
+            // Replace every occurrence of the selected text with
+            // the text of the clipboard, as a single step to
+            // undo. Following relies on the last line.
+            if (!control 
+                    || !pState->selecting 
+                    || pState->pClipboard == NULL || pCore->following) {
+                return repaint;
+                
+            }
+            orderSelection(pState, &pFirst, &pLast);
+            if (pFirst->pNode != pLast->pNode) {
+                return repaint;
+                
+            }
+            pLine = &pFirst->pNode->line;
+            firstIndex = pFirst->characterIndex < pLine->characters
+                ? pFirst->characterIndex : pLine->characters;
+            lastIndex = pLast->characterIndex < pLine->characters
+                ? pLast->characterIndex : pLine->characters;
+            
+            pReplacement = joinClipText(pState->pClipboard, 
+                &replacementCharacters);
+            if (pReplacement == NULL) {
+                return repaint;
+                
+            }
+            
+            // The pattern points into a line of the deque, which
+            // the search reads before any line changes. Nothing
+            // changes without a match.
+            result = replaceAllInDeque(pState->dequeArr, 
+                LINE_TEXT(pLine)+firstIndex, lastIndex-firstIndex,
+                pReplacement, replacementCharacters, &damage);
+            free(pReplacement);
+            if (result != ES_ERROR_SUCCESS || pPreviousStep 
+                    == pState->dequeArr[0].pUndoHistory) {
+                return repaint;
+                
+            }
+            pState->selecting = FALSE;
+            
+            refreshRectangle = showDamage(pCore, &damage);
+            break;
+        }
+        
+        case 'W': {
+            sWrapLayout *pLayout = pState->pWrapLayout;
+            
+            if (!control) {
+                return repaint;
+                
+            }
+            
+            // Toggle soft wrapping. Turning it on only estimates
+            // rows, so it costs no time on large files.
+            if (pLayout != NULL) {
+                cancelTasks(pCore->pScheduler, pLayout);
+                destructWrapLayout(pLayout);
+                free(pLayout);
+                pState->pWrapLayout = NULL;
+                
+            } else {
+                pLayout = malloc(sizeof(sWrapLayout));
+                if (pLayout == NULL 
+                        || constructWrapLayout(pLayout, 
+                        pState->dequeArr[0].lines, 
+                        wrapColumns(pCore->width)) 
+                        != ES_ERROR_SUCCESS) {
+                    free(pLayout);
+                    return repaint;
+                    
+                }
+                pState->pWrapLayout = pLayout;
+                scheduleWrapResolving(pCore);
+                
+            }
+            pState->firstVisibleRowInLine = 0;
+            
+            // Rows of unwrapped lines differ from the wrapped rows.
+            if (pState->pWrapLayout == NULL) {
+                return repaintWholeView();
+                
+            }
+            break;
+        }
+        
+        case 'L': {
+            sLineDeque *pDeque = pState->dequeArr;
+            const unsigned long previousLines = pDeque->lines;
+            sDamage damage;
+            
+            // Sort the lines, and drop duplicate lines along with
+            // the Shift key. Following relies on the last line.
+            if (!control || pCore->following
+                    || sortDequeLines(pDeque, 
+                    shift, &damage) 
+                    != ES_ERROR_SUCCESS) {
+                return repaint;
+                
+            }
+            pState->selecting = FALSE;
+            
+            showReorderedDeque(pCore, previousLines);
+            return repaintWholeView();
+        }
+        
+        case 'K': {
+            sLineDeque *pDeque = pState->dequeArr;
+            const sLine *pLine = 
+                &pState->pActiveHead->pNode->line;
+            const unsigned long previousLines = pDeque->lines;
+            sDamage damage;
+            
+            // Keep the lines that contain the text of the line
+            // with the write head, or drop them along with the
+            // Shift key. Dropped lines keep their text alive.
+            if (!control || pCore->following
+                    || filterDequeLines(pDeque, LINE_TEXT(pLine), 
+                    pLine->characters, !shift,
+                    &damage) != ES_ERROR_SUCCESS) {
+                return repaint;
+                
+            }
+            pState->selecting = FALSE;
+            
+            showReorderedDeque(pCore, previousLines);
+            return repaintWholeView();
+        }
+        
+        case 'T': {
+            sLineDeque *pDeque = pState->dequeArr;
+            
+            if (!control 
+                    || pDeque->hFile == INVALID_HANDLE_VALUE) {
+                return repaint;
+                
+            }
+            
+            // Toggle pCore->following the bytes that other processes
+            // append to the open file.
+            if (pCore->following) {
+                stopFollowing(&pCore->follower);
+                pCore->following = FALSE;
+                
+            } else if (startFollowing(&pCore->follower, pDeque->hFile, 
+                    pDeque, ES_FOLLOW_MAXIMUM_LINES) 
+                    == ES_ERROR_SUCCESS) {
+                pCore->following = TRUE;
+                
+            }
+            
+            return repaint;
+        }
+        
+        case 'D': {
+            sLineDeque *pDeque = pState->dequeArr;
+            sDiff *pDiff = pState->pDiff;
+            
+            if (!control 
+                    || pDeque->hFile == INVALID_HANDLE_VALUE) {
+                return repaint;
+                
+            }
+            
+            // Toggle the gutter markers of lines that differ
+            // from the file on disk. Edits leave the markers as
+            // they are until the next toggle.
+            if (pDiff != NULL) {
+                destructDiff(pDiff);
+                free(pDiff);
+                pState->pDiff = NULL;
+                
+            } else {
+                pDiff = malloc(sizeof(sDiff));
+                if (pDiff == NULL 
+                        || diffDequeWithFile(pDeque->hFile, pDeque,
+                        pDiff) != ES_ERROR_SUCCESS) {
+                    free(pDiff);
+                    return repaint;
+                    
+                }
+                pState->pDiff = pDiff;
+                
+            }
+            
+            return repaintWholeView();
+        }
+        
+    }
+    
+    // Rows of wrapped lines move whenever a line changes, so
+    // repaint the whole view.
+    if (pState->pWrapLayout != NULL) {
+        placeWrappedHighlight(pState);
+        return repaintWholeView();
+        
+    }
+    
+    // Selections span more rows than the highlight.
+    if (selecting || pState->selecting) {
+        return repaintWholeView();
+        
+    }
+    
+    repaint.changed = TRUE;
+    repaint.partial = TRUE;
+    repaint.rectangle = refreshRectangle;
+    
+    return repaint;
+}
+
+// Moves the write head to a clicked row. Clicks along with the Shift
+// key extend the selection.
+sRepaint clickEditor(sEditorCore *pCore, unsigned short x, unsigned short y,
+        unsigned int modifiers) {
+    
+    sEditorState *pState = &pCore->state;
+    const unsigned short lines = y / ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
+    const int selecting = pState->selecting;
+    sRepaint repaint = { TRUE, TRUE, { 0, 0, 0, 0 }, FALSE };
+    
+    extendSelection(pState, (modifiers & ES_MODIFIER_SHIFT) != 0);
+    
+    // Convert the clicked row into a line and the row within it.
+    if (pState->pWrapLayout != NULL) {
+        const sWrapLayout *pLayout = pState->pWrapLayout;
+        const sLineNode *pNode;
+        unsigned long rowInLine;
+        unsigned int rowStart = 0;
+        
+        moveHeadToLine(pState, lineOfRow(pLayout, 
+            rowOfLine(pLayout, pState->firstVisibleLineIndex)
+            + pState->firstVisibleRowInLine + lines, 
+            &rowInLine));
+        
+        pNode = pState->pActiveHead->pNode;
+        while (rowInLine--) {
+            rowStart = nextWrapBreak(LINE_TEXT(&pNode->line), 
+                pNode->line.characters, rowStart, 
+                pLayout->columns);
+        }
+        
+        rowStart += x >= ES_LAYOUT_LINECOUNT_WIDTH ?
+            (x - ES_LAYOUT_LINECOUNT_WIDTH) 
+            / ES_LAYOUT_LINECOUNT_FONT_WIDTH : 0;
+        pState->pActiveHead->characterIndex = 
+            rowStart < pNode->line.characters ? rowStart 
+            : pNode->line.characters;
+        
+        placeWrappedHighlight(pState);
+        repaint.partial = FALSE;
+        repaint.erase = selecting || pState->selecting;
+        return repaint;
+        
+    }
+    
+    repaint.rectangle = updateHighlight(pState, pCore->width, lines);
+    jumpHead(pState, &repaint.rectangle);
+    
+    pState->pActiveHead->characterIndex = 
+        x >= ES_LAYOUT_LINECOUNT_WIDTH ?
+        (x - ES_LAYOUT_LINECOUNT_WIDTH) 
+        / ES_LAYOUT_LINECOUNT_FONT_WIDTH : 0;
+    if (pState->pActiveHead->characterIndex 
+            > pState->pActiveHead->pNode->line.characters) {
+        pState->pActiveHead->characterIndex = 
+            pState->pActiveHead->pNode->line.characters;
+        
+    }
+    
+    if (selecting || pState->selecting) {
+        return repaintWholeView();
+        
+    }
+    
+    return repaint;
+}
+
+sRepaint scrollEditor(sEditorCore *pCore, signed short wheelDelta) {
+    
+    sEditorState *pState = &pCore->state;
+    const signed short jumps = -wheelDelta / ES_SCROLL_NUMBNESS;
+    const signed long update = pState->firstVisibleLineIndex + jumps;
+    
+    // Wrapped views scroll by rows rather than by lines.
+    if (pState->pWrapLayout != NULL) {
+        scrollWrappedView(pState, jumps);
+        
+    /*XXX: Consider multiple files later on.*/
+    } else if (update>=0
+            && update<(signed long)pState->dequeArr[0].lines) {
+        pState->firstVisibleLineIndex = update;
+    }
+    
+    return repaintWholeView();
+}
+
+// Takes the lines that the follower read since the last frame, so that
+// the view repaints at most once per frame.
+sRepaint takeFollowedLines(sEditorCore *pCore) {
+    
+    sEditorState *pState = &pCore->state;
+    sLineDeque *pDeque = pState->dequeArr;
+    sWrapLayout *pLayout = pState->pWrapLayout;
+    const unsigned long visibleRows = countVisibleRows(pCore);
+    const unsigned long previousLines = pDeque->lines;
+    sRepaint repaint = { FALSE, FALSE, { 0, 0, 0, 0 }, TRUE };
+    unsigned long appendedLines, droppedLines;
+    int pinned;
+    
+    if (!pCore->following) {
+        return repaint;
+        
+    }
+    
+    // The view stays at the bottom while it shows the last row.
+    if (pLayout != NULL) {
+        pinned = rowOfLine(pLayout, pState->firstVisibleLineIndex)
+            + pState->firstVisibleRowInLine + visibleRows 
+            >= totalWrapRows(pLayout);
+        
+    } else {
+        pinned = pState->firstVisibleLineIndex + visibleRows
+            >= previousLines;
+        
+    }
+    
+    appendedLines = drainFollower(&pCore->follower, pDeque, 
+        &droppedLines);
+    if (appendedLines == 0) {
+        return repaint;
+        
+    }
+    
+    // The batch replaced the last line and may have dropped the
+    // first ones, either of which may hold the selection anchor.
+    if (pState->selecting) {
+        pState->selecting = FALSE;
+        repaint = repaintWholeView();
+        
+    }
+    
+    // The batch replaced the last line. Rows of lines at the end
+    // extend the wrap layout without rebuilding it.
+    if (pLayout != NULL) {
+        replaceWrapLines(pLayout, previousLines - 1, 1, appendedLines);
+        if (droppedLines > 0) {
+            replaceWrapLines(pLayout, 0, droppedLines, 0);
+            
+        }
+    }
+    
+    if (pinned) {
+        pinViewToBottom(pState, visibleRows);
+        
+    } else if (droppedLines > 0) {
+        
+        // Keep the same text in view as the oldest lines leave.
+        if (pState->firstVisibleLineIndex > droppedLines) {
+            pState->firstVisibleLineIndex -= droppedLines;
+            
+        } else {
+            pState->firstVisibleLineIndex = 0;
+            pState->firstVisibleRowInLine = 0;
+            
+        }
+        
+    // Unwrapped views above the last line show nothing new.
+    } else if (pLayout == NULL) {
+        return repaint;
+        
+    }
+    
+    if (pLayout != NULL) {
+        scheduleWrapResolving(pCore);
+        
+    }
+    
+    return repaintWholeView();
+}
+
+// Finds the line on the first row of the view, walking from the write
+// head. Wrapped views first compute the wrap points of the visible
+// lines that still have estimated rows, and skip the rows of the first
+// line above the view, whose end goes to `pRowStart`.
+const sLineNode *findFirstVisibleLine(sEditorCore *pCore,
+        unsigned int *pRowStart) {
+    
+    const sEditorState *pState = &pCore->state;
+    const sLineNode *pNode = pState->pActiveHead->pNode;
+    signed long jumps = pState->pActiveHead->lineIndex
+        - pState->firstVisibleLineIndex;
+    sWrapLayout *pLayout = pState->pWrapLayout;
+    
+    if (jumps > 0) {
+        while (jumps--) pNode = pNode->pPrev;
+        
+    } else {
+        while (jumps++) pNode = pNode->pNext;
+        
+    }
+    
+    *pRowStart = 0;
+    if (pLayout != NULL) {
+        unsigned long rowInLine = pState->firstVisibleRowInLine;
+        
+        resolveWrapLines(pLayout, pState->firstVisibleLineIndex, pNode, 
+            countVisibleRows(pCore));
+        while (pNode != NULL && rowInLine--) {
+            *pRowStart = nextWrapBreak(LINE_TEXT(&pNode->line), 
+                pNode->line.characters, *pRowStart, pLayout->columns);
+        }
+    }
+    
+    return pNode;
+}
+
+// Does the work of a paint without drawing: finds the lines of the view
+// and the rows they wrap into. Returns the characters that the view
+// shows, which a replay reads so that the walk is not left out.
+unsigned long layoutEditorFrame(sEditorCore *pCore) {
+    
+    const sWrapLayout *pLayout = pCore->state.pWrapLayout;
+    const unsigned long visibleRows = countVisibleRows(pCore);
+    unsigned int rowStart;
+    const sLineNode *pNode = findFirstVisibleLine(pCore, &rowStart);
+    unsigned long row, characters = 0;
+    
+    for (row = 0; row < visibleRows && pNode != NULL; ++row) {
+        unsigned int rowEnd = pNode->line.characters;
+        
+        if (pLayout != NULL) {
+            rowEnd = nextWrapBreak(LINE_TEXT(&pNode->line), 
+                pNode->line.characters, rowStart, pLayout->columns);
+            
+        }
+        characters += rowEnd - rowStart;
+        if (rowEnd >= pNode->line.characters) {
+            pNode = pNode->pNext;
+            rowStart = 0;
+            
+        } else {
+            rowStart = rowEnd;
+            
+        }
+    }
+    
+    return characters;
+}
+
+// Puts the ends of the selection in the order of the document.
+void orderSelection(const sEditorState *pState, const sWriteHead **ppFirst,
+        const sWriteHead **ppLast) {
+    
+    const sWriteHead *pAnchor = &pState->selectionAnchor;
+    const sWriteHead *pHead = pState->pActiveHead;
+    
+    if (pAnchor->lineIndex < pHead->lineIndex 
+            || (pAnchor->lineIndex == pHead->lineIndex 
+            && pAnchor->characterIndex <= pHead->characterIndex)) {
+        *ppFirst = pAnchor;
+        *ppLast = pHead;
+        
+    } else {
+        *ppFirst = pHead;
+        *ppLast = pAnchor;
+        
+    }
+    
+    return;
+}
+
+static sRepaint repaintWholeView(void) {
+    
+    const sRepaint repaint = { TRUE, FALSE, { 0, 0, 0, 0 }, TRUE };
+    
+    return repaint;
+}
+
+static unsigned long countVisibleRows(const sEditorCore *pCore) {
+    return pCore->height / ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
+}
+
+static void jumpHead(sEditorState *pState, const RECT *pRefreshRectangle) {
+    
+    sLineNode *pNode = pState->pActiveHead->pNode;
+    
+    if (pState->curHighlight.relativeFocusLineIndex 
+            > pState->prevHighlight.relativeFocusLineIndex) {
+    
+        long int top = pRefreshRectangle->top;
+        
+        while ((top += ES_LAYOUT_LINECOUNT_FONT_HEIGHT)
+                != pRefreshRectangle->bottom && pNode->pNext != NULL) {
+            
+            pNode = pNode->pNext;
+        }
+        
+    } else {
+        
+        long int bottom = pRefreshRectangle->bottom;
+        
+        while ((bottom -= ES_LAYOUT_LINECOUNT_FONT_HEIGHT)
+                != pRefreshRectangle->top && pNode->pPrev != NULL) {
+            
+            pNode = pNode->pPrev;
+        }
+        
+    }
+    
+    pState->pActiveHead->pNode = pNode;
+    return;
+}
+
+static RECT updateHighlight(sEditorState* pEditorState,
+        const unsigned short windowWidth,
+        const unsigned short curRelativeIndex) {
+    
+    RECT refreshRectangle;
+    
+    pEditorState->prevHighlight = pEditorState->curHighlight;
+    pEditorState->curHighlight.relativeFocusLineIndex = curRelativeIndex;
+    pEditorState->curHighlight.top = ES_LAYOUT_LINECOUNT_FONT_HEIGHT
+        * pEditorState->curHighlight.relativeFocusLineIndex;
+    
+    refreshRectangle.left = ES_LAYOUT_LINECOUNT_WIDTH;
+    refreshRectangle.right = windowWidth;
+    if (pEditorState->curHighlight.top 
+            > pEditorState->prevHighlight.top) {
+        
+        refreshRectangle.top = pEditorState->prevHighlight.top;
+        refreshRectangle.bottom = pEditorState->curHighlight.top
+            + ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
+            
+    } else {
+        refreshRectangle.top = pEditorState->curHighlight.top;
+        refreshRectangle.bottom = pEditorState->prevHighlight.top
+            + ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
+        
+    }
+    
+    // Update the index for the write head.
+    pEditorState->pActiveHead->lineIndex += curRelativeIndex
+        - pEditorState->prevHighlight.relativeFocusLineIndex;
+    
+    return refreshRectangle;
+}
+
+// Converts the lines that a batch of edits rebuilt into the single
+// rectangle to repaint. The highlight follows the write head.
+static RECT rectangleFromDamage(sEditorState *pEditorState, 
+        const sDamage *pDamage, const unsigned short windowWidth,
+        const unsigned short windowHeight) {
+    
+    RECT refreshRectangle = {
+        .left = 0,
+        .top = 0,
+        .right = windowWidth,
+        .bottom = windowHeight};
+    const unsigned long firstVisibleLineIndex = 
+        pEditorState->firstVisibleLineIndex;
+    
+    pEditorState->prevHighlight = pEditorState->curHighlight;
+    pEditorState->curHighlight.relativeFocusLineIndex = 
+        pEditorState->pActiveHead->lineIndex - firstVisibleLineIndex;
+    pEditorState->curHighlight.top = ES_LAYOUT_LINECOUNT_FONT_HEIGHT
+        * pEditorState->curHighlight.relativeFocusLineIndex;
+    
+    // Lines above the view only matter when they shift the view.
+    if (pDamage->lastLineIndex < firstVisibleLineIndex
+            && pDamage->lineDelta == 0) {
+        refreshRectangle.bottom = refreshRectangle.top;
+        
+    } else if (pDamage->firstLineIndex > firstVisibleLineIndex) {
+        refreshRectangle.top = ES_LAYOUT_LINECOUNT_FONT_HEIGHT
+            * (pDamage->firstLineIndex - firstVisibleLineIndex);
+        
+    }
+    
+    // Lines below the damage only move when the line count changes.
+    if (pDamage->lineDelta == 0 
+            && pDamage->lastLineIndex >= firstVisibleLineIndex) {
+        const unsigned long bottom = ES_LAYOUT_LINECOUNT_FONT_HEIGHT
+            * (pDamage->lastLineIndex - firstVisibleLineIndex + 1);
+        
+        if (bottom < (unsigned long) refreshRectangle.bottom) {
+            refreshRectangle.bottom = bottom;
+            
+        }
+    }
+    
+    return refreshRectangle;
+}
+
+// Walks the write head to another line of the deque.
+static void moveHeadToLine(sEditorState *pState, unsigned long lineIndex) {
+    
+    sWriteHead *pHead = pState->pActiveHead;
+    
+    while (pHead->lineIndex < lineIndex && pHead->pNode->pNext != NULL) {
+        pHead->pNode = pHead->pNode->pNext;
+        ++(pHead->lineIndex);
+    }
+    while (pHead->lineIndex > lineIndex && pHead->pNode->pPrev != NULL) {
+        pHead->pNode = pHead->pNode->pPrev;
+        --(pHead->lineIndex);
+    }
+    
+    return;
+}
+
+// Moves the top of a wrapped view by visual rows. The view stays 
+// anchored to a line, so that resolving the rows of lines above the 
+// view does not move the text on the screen.
+static void scrollWrappedView(sEditorState *pState, signed long rows) {
+    
+    const sWrapLayout *pLayout = pState->pWrapLayout;
+    const unsigned long totalRows = totalWrapRows(pLayout);
+    unsigned long row = rowOfLine(pLayout, pState->firstVisibleLineIndex)
+        + pState->firstVisibleRowInLine;
+    
+    if (rows < 0 && (unsigned long) -rows > row) {
+        row = 0;
+        
+    } else {
+        row += rows;
+        
+    }
+    if (row >= totalRows) {
+        row = totalRows > 0 ? totalRows - 1 : 0;
+        
+    }
+    
+    pState->firstVisibleLineIndex = lineOfRow(pLayout, row, 
+        &pState->firstVisibleRowInLine);
+    
+    return;
+}
+
+// Puts the highlight on the first row of the line with the write head.
+// A head above the view scrolls the view up to its line, since the
+// highlight can't sit above the first row.
+static void placeWrappedHighlight(sEditorState *pState) {
+    
+    const sWrapLayout *pLayout = pState->pWrapLayout;
+    const unsigned long viewRow = rowOfLine(pLayout, 
+        pState->firstVisibleLineIndex) + pState->firstVisibleRowInLine;
+    const unsigned long headRow = rowOfLine(pLayout, 
+        pState->pActiveHead->lineIndex);
+    
+    pState->prevHighlight = pState->curHighlight;
+    if (headRow >= viewRow) {
+        pState->curHighlight.relativeFocusLineIndex = headRow - viewRow;
+        pState->curHighlight.top = ES_LAYOUT_LINECOUNT_FONT_HEIGHT
+            * pState->curHighlight.relativeFocusLineIndex;
+        
+    } else {
+        pState->firstVisibleLineIndex = pState->pActiveHead->lineIndex;
+        pState->firstVisibleRowInLine = 0;
+        pState->curHighlight.relativeFocusLineIndex = 0;
+        pState->curHighlight.top = 0;
+        
+    }
+    
+    return;
+}
+
+// Resolves the wrap points of the lines around the view first, then
+// those of the whole document, while the editor waits for input. The
+// previous tasks of the layout may refer to lines that changed.
+static void scheduleWrapResolving(sEditorCore *pCore) {
+    
+    const sEditorState *pState = &pCore->state;
+    const unsigned long visibleRows = countVisibleRows(pCore);
+    sWrapLayout *pLayout = pState->pWrapLayout;
+    const sLineDeque *pDeque = pState->dequeArr;
+    const sLineNode *pNode = pState->pActiveHead->pNode;
+    unsigned long lineIndex = pState->pActiveHead->lineIndex;
+    const unsigned long nearbyLineIndex = 
+        pState->firstVisibleLineIndex > visibleRows 
+        ? pState->firstVisibleLineIndex - visibleRows : 0;
+    sWrapResolver *pNearby = malloc(sizeof(sWrapResolver));
+    sWrapResolver *pEverything = malloc(sizeof(sWrapResolver));
+    
+    cancelTasks(pCore->pScheduler, pLayout);
+    if (pNearby == NULL || pEverything == NULL) {
+        free(pNearby);
+        free(pEverything);
+        return;
+        
+    }
+    
+    // The page above the view, the view and the page below it.
+    while (lineIndex > nearbyLineIndex && pNode->pPrev != NULL) {
+        pNode = pNode->pPrev;
+        --lineIndex;
+    }
+    while (lineIndex < nearbyLineIndex && pNode->pNext != NULL) {
+        pNode = pNode->pNext;
+        ++lineIndex;
+    }
+    pNearby->pLayout = pLayout;
+    pNearby->pNode = pNode;
+    pNearby->lineIndex = lineIndex;
+    pNearby->lastLineIndex = pState->firstVisibleLineIndex + 2*visibleRows;
+    
+    pEverything->pLayout = pLayout;
+    pEverything->pNode = pDeque->pHead;
+    pEverything->lineIndex = 0;
+    pEverything->lastLineIndex = pDeque->lines;
+    
+    if (!scheduleTask(pCore->pScheduler, ES_TASK_PRIORITY_VISIBLE, pLayout, 
+            &stepWrapResolver, &free, pNearby)) {
+        free(pNearby);
+        
+    }
+    if (!scheduleTask(pCore->pScheduler, ES_TASK_PRIORITY_BACKGROUND, 
+            pLayout, &stepWrapResolver, &free, pEverything)) {
+        free(pEverything);
+        
+    }
+    
+    return;
+}
+
+static unsigned short wrapColumns(const unsigned short windowWidth) {
+    return windowWidth > ES_LAYOUT_LINECOUNT_WIDTH 
+        ? (windowWidth - ES_LAYOUT_LINECOUNT_WIDTH) 
+        / ES_LAYOUT_LINECOUNT_FONT_WIDTH : 1;
+}
+
+// Moves the view and the write head to the end of the deque, so that
+// the last line shows on the last visible row.
+static void pinViewToBottom(sEditorState *pState,
+        unsigned long visibleRows) {
+    
+    const sLineDeque *pDeque = pState->dequeArr;
+    sWrapLayout *pLayout = pState->pWrapLayout;
+    sWriteHead *pHead = pState->pActiveHead;
+    
+    pHead->pNode = pDeque->pTail;
+    pHead->lineIndex = pDeque->lines - 1;
+    pHead->characterIndex = 0;
+    
+    // Only the rows of the lines at the bottom need to be exact.
+    if (pLayout != NULL) {
+        const sLineNode *pNode = pDeque->pTail;
+        unsigned long lineIndex = pDeque->lines - 1, totalRows;
+        
+        while (lineIndex > 0 && pDeque->lines - lineIndex < visibleRows) {
+            pNode = pNode->pPrev;
+            --lineIndex;
+        }
+        resolveWrapLines(pLayout, lineIndex, pNode, visibleRows);
+        
+        totalRows = totalWrapRows(pLayout);
+        pState->firstVisibleLineIndex = lineOfRow(pLayout, 
+            totalRows > visibleRows ? totalRows - visibleRows : 0, 
+            &pState->firstVisibleRowInLine);
+        placeWrappedHighlight(pState);
+        return;
+        
+    }
+    
+    pState->firstVisibleLineIndex = pDeque->lines > visibleRows 
+        ? pDeque->lines - visibleRows : 0;
+    pState->prevHighlight = pState->curHighlight;
+    pState->curHighlight.relativeFocusLineIndex = pHead->lineIndex 
+        - pState->firstVisibleLineIndex;
+    pState->curHighlight.top = ES_LAYOUT_LINECOUNT_FONT_HEIGHT
+        * pState->curHighlight.relativeFocusLineIndex;
+    
+    return;
+}
+
+// Shows the first line after an operation that rebuilt the whole
+// document, where the write head went. Rows of a wrap layout start
+// over as estimates.
+static void showReorderedDeque(sEditorCore *pCore, 
+        unsigned long previousLines) {
+    
+    sEditorState *pState = &pCore->state;
+    
+    pState->firstVisibleLineIndex = 0;
+    pState->firstVisibleRowInLine = 0;
+    pState->prevHighlight = pState->curHighlight;
+    pState->curHighlight.relativeFocusLineIndex = 0;
+    pState->curHighlight.top = 0;
+    
+    if (pState->pWrapLayout != NULL) {
+        replaceWrapLines(pState->pWrapLayout, 0, previousLines, 
+            pState->dequeArr->lines);
+        scheduleWrapResolving(pCore);
+        
+    }
+    
+    return;
+}
+
+// Brings the write head into view after an edit of the document, and
+// returns the rectangle to repaint. Wrapped views also update the rows
+// of the lines that the edit rebuilt.
+static RECT showDamage(sEditorCore *pCore, const sDamage *pDamage) {
+    
+    sEditorState *pState = &pCore->state;
+    const unsigned long visibleLines = countVisibleRows(pCore);
+    const unsigned long headLineIndex = pState->pActiveHead->lineIndex;
+    int scrolled = TRUE;
+    RECT refreshRectangle;
+    
+    // Undoing a sort or a filter moves the write head to the first line,
+    // and pasted text may leave it below the view.
+    if (headLineIndex < pState->firstVisibleLineIndex) {
+        pState->firstVisibleLineIndex = headLineIndex;
+        
+    } else if (visibleLines > 0 
+            && headLineIndex >= pState->firstVisibleLineIndex 
+            + visibleLines) {
+        pState->firstVisibleLineIndex = headLineIndex - visibleLines + 1;
+        
+    } else {
+        scrolled = FALSE;
+        
+    }
+    if (scrolled) {
+        pState->firstVisibleRowInLine = 0;
+        
+    }
+    
+    refreshRectangle = rectangleFromDamage(pState, pDamage, pCore->width, 
+        pCore->height);
+    if (scrolled) {
+        refreshRectangle.top = 0;
+        refreshRectangle.bottom = pCore->height;
+        
+    }
+    
+    if (pState->pWrapLayout == NULL) {
+        return refreshRectangle;
+        
+    }
+    
+    // Only lines that the edit added or removed shift the rows below
+    // them.
+    if (pDamage->lineDelta != 0) {
+        const unsigned long lines = pDamage->lastLineIndex
+            - pDamage->firstLineIndex + 1;
+        
+        replaceWrapLines(pState->pWrapLayout, pDamage->firstLineIndex, 
+            lines - pDamage->lineDelta, lines);
+        
+    } else {
+        invalidateWrapLines(pState->pWrapLayout, pDamage->firstLineIndex, 
+            pDamage->lastLineIndex);
+        
+    }
+    scheduleWrapResolving(pCore);
+    
+    return refreshRectangle;
+}
+
+// Anchors a selection at the write head before the head moves along with
+// the Shift key, and drops the selection when the head moves without it.
+static void extendSelection(sEditorState *pState, int shift) {
+    
+    if (!shift) {
+        pState->selecting = FALSE;
+        
+    } else if (!pState->selecting) {
+        pState->selectionAnchor = *pState->pActiveHead;
+        pState->selecting = TRUE;
+        
+    }
+    
+    return;
+}
+
+// Puts a clip on the clipboard, which owns the reference of the caller.
+// The spares of the previous clip go away, since only pastes from the
+// clipboard use them.
+static void replaceClipboard(sEditorCore *pCore, sClip *pClip) {
+    
+    sEditorState *pState = &pCore->state;
+    
+    if (pState->pClipboard != NULL) {
+        cancelTasks(pCore->pScheduler, pState->pClipboard);
+        discardClipSpare(pState->pClipboard);
+        releaseClip(pState->pClipboard);
+        
+    }
+    pState->pClipboard = pClip;
+    scheduleClipSpare(pCore);
+    
+    return;
+}
+
+// Copies the inner lines of the clipboard ahead of the next paste, so
+// that the paste moves the copies into the deque instead of making
+// them while the user waits.
+static void scheduleClipSpare(sEditorCore *pCore) {
+    
+    sClip *pClip = pCore->state.pClipboard;
+    const sLineNode *pSource;
+    
+    if (pClip == NULL) {
+        return;
+        
+    }
+    cancelTasks(pCore->pScheduler, pClip);
+    pSource = findNextSpareSource(pClip);
+    if (pSource != NULL && pSource != pClip->lines.pTail) {
+        scheduleTask(pCore->pScheduler, ES_TASK_PRIORITY_BACKGROUND, 
+            pClip, &stepClipSpare, NULL, pClip);
+        
+    }
+    
+    return;
+}
+
+// Joins the lines of a clip with line feed characters into a single
+// text, which the caller frees.
+static char *joinClipText(const sClip *pClip, unsigned int *pCharacters) {
+    
+    const sLineNode *pNode;
+    size_t characters = 0;
+    char *pText;
+    
+    for (pNode = pClip->lines.pHead; pNode != NULL; pNode = pNode->pNext) {
+        characters += pNode->line.characters + 1;
+    }
+    if (characters == 0 || characters - 1 > (unsigned int) -1) {
+        return NULL;
+        
+    }
+    
+    pText = malloc(sizeof(char)*characters);
+    if (pText == NULL) {
+        return NULL;
+        
+    }
+    
+    *pCharacters = 0;
+    for (pNode = pClip->lines.pHead; pNode != NULL; pNode = pNode->pNext) {
+        memcpy(pText + *pCharacters, LINE_TEXT(&pNode->line), 
+            sizeof(char)*pNode->line.characters);
+        *pCharacters += pNode->line.characters;
+        pText[(*pCharacters)++] = '\n';
+    }
+    --(*pCharacters);
+    
+    return pText;
+}
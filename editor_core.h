@@ -0,0 +1,52 @@
+#include "global_data.h"
+#include "task_scheduler.h"
+#include "follow_mode.h"
+
+#ifndef _HEADER_EDITOR_CORE
+
+// Modifier keys held during an input event. The core takes them along
+// with the event instead of asking the keyboard, so that a replay can
+// hold them without a window.
+#define ES_MODIFIER_CONTROL 1
+#define ES_MODIFIER_SHIFT 2
+
+// The editor without its window. The window procedure and the headless
+// replay of a trace both feed input events to it, and only the window
+// paints what the events changed.
+typedef struct {
+    sEditorState state;
+    sTaskScheduler *pScheduler;
+    unsigned short width, height;   // Size of the view in pixels.
+    sFollower follower;             // Tails the open source.
+    int following;
+} sEditorCore;
+
+// Part of the view that an event changed. The whole view repaints
+// unless `partial` is set, and nothing repaints unless `changed` is.
+typedef struct {
+    int changed;
+    int partial;
+    RECT rectangle;
+    int erase;
+} sRepaint;
+
+void constructEditorCore(sEditorCore *pCore, sTaskScheduler *pScheduler);
+void destructEditorCore(sEditorCore *pCore);
+enum EsError openEditorDocument(sEditorCore *pCore, const char *pPath);
+enum EsError followEditorInput(sEditorCore *pCore, HANDLE hSource);
+void resizeEditor(sEditorCore *pCore, unsigned short width,
+    unsigned short height);
+sRepaint pressEditorKey(sEditorCore *pCore, WPARAM key,
+    unsigned int modifiers);
+sRepaint clickEditor(sEditorCore *pCore, unsigned short x, unsigned short y,
+    unsigned int modifiers);
+sRepaint scrollEditor(sEditorCore *pCore, signed short wheelDelta);
+sRepaint takeFollowedLines(sEditorCore *pCore);
+const sLineNode *findFirstVisibleLine(sEditorCore *pCore,
+    unsigned int *pRowStart);
+unsigned long layoutEditorFrame(sEditorCore *pCore);
+void orderSelection(const sEditorState *pState, const sWriteHead **ppFirst,
+    const sWriteHead **ppLast);
+
+#define _HEADER_EDITOR_CORE
+#endif
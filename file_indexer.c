@@ -0,0 +1,210 @@
+#include <string.h>
+#include "file_indexer.h"
+
+// A chunk of the mapped file that one thread indexes.
+typedef struct {
+    const char *pFile;          // Start of the mapped file.
+    size_t fileBytes;           // Size of the mapped file.
+    size_t firstByte;           // Start of the chunk.
+    size_t lastByte;            // End of the chunk, exclusive.
+    sInternTable *pTable;       // Shared text of lines, if any.
+    sLineChain chain;           // Lines that start in the chunk.
+    enum EsError result;        // Outcome of the indexing.
+} sIndexChunk;
+
+static DWORD WINAPI indexChunk(LPVOID pParameter);
+
+// Indexes the lines of a file into the end of the deque. The file is
+// mapped into memory and split into one chunk per processor. Each
+// thread builds the nodes of its own chunk, so that joining the
+// chunks only links their ends. Interning lines makes identical lines
+// share their text.
+enum EsError indexFileIntoDeque(HANDLE hFile, sLineDeque *pDeque, 
+        int internLines) {
+    
+    HANDLE threadArr[MAXIMUM_WAIT_OBJECTS];     // Indexing threads.
+    sIndexChunk chunkArr[MAXIMUM_WAIT_OBJECTS]; // Chunks of the file.
+    LARGE_INTEGER fileSize;                     // Bytes in the file.
+    SYSTEM_INFO systemInfo;                     // Processor count.
+    sInternTable table;                         // Shared line text.
+    HANDLE hMapping;                            // Mapping of the file.
+    const char *pFile;                          // Mapped file view.
+    size_t fileBytes, chunkBytes;
+    unsigned long chunks, chunkIndex;
+    int tailReturn;                             // Last line ends in CR.
+    enum EsError result = ES_ERROR_SUCCESS;
+    
+    if (!GetFileSizeEx(hFile, &fileSize)) {
+        return ES_ERROR_PARSING_ERROR;
+        
+    }
+    
+    // Windows refuses to map empty files. Such a file still has a
+    // single empty line.
+    if (fileSize.QuadPart == 0) {
+        sLineChain chain = { 0 };
+        size_t consumed;
+        
+        result = splitLinesIntoChain("", 0, TRUE, NULL, &chain, 
+            &consumed);
+        appendChainToDeque(&chain, pDeque);
+        return result;
+        
+    }
+    
+    // The whole file must fit in the address space of the process.
+    if ((unsigned long long) fileSize.QuadPart > (size_t) -1) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    fileBytes = (size_t) fileSize.QuadPart;
+    pDeque->loadedBytes += fileBytes;
+    
+    hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping == NULL) {
+        return ES_ERROR_PARSING_ERROR;
+        
+    }
+    pFile = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (pFile == NULL) {
+        CloseHandle(hMapping);
+        return ES_ERROR_PARSING_ERROR;
+        
+    }
+    
+    // Use one chunk per processor, unless the chunks become too small
+    // to outweigh the cost of a thread.
+    GetSystemInfo(&systemInfo);
+    chunks = systemInfo.dwNumberOfProcessors;
+    if (chunks > MAXIMUM_WAIT_OBJECTS) {
+        chunks = MAXIMUM_WAIT_OBJECTS;
+        
+    }
+    if (chunks > fileBytes / ES_INDEX_MINIMUM_CHUNK_BYTES) {
+        chunks = fileBytes / ES_INDEX_MINIMUM_CHUNK_BYTES;
+        
+    }
+    if (chunks < 1) {
+        chunks = 1;
+        
+    }
+    chunkBytes = fileBytes / chunks;
+    
+    if (internLines && constructInternTable(&table, 
+            fileBytes / ES_INDEX_BYTES_PER_LINE) != ES_ERROR_SUCCESS) {
+        internLines = FALSE;
+        
+    }
+    
+    for (chunkIndex = 0; chunkIndex < chunks; ++chunkIndex) {
+        sIndexChunk *pChunk = chunkArr + chunkIndex;
+        
+        pChunk->pFile = pFile;
+        pChunk->fileBytes = fileBytes;
+        pChunk->firstByte = chunkIndex*chunkBytes;
+        pChunk->lastByte = chunkIndex+1 == chunks ? fileBytes
+            : pChunk->firstByte + chunkBytes;
+        pChunk->pTable = internLines ? &table : NULL;
+        pChunk->chain.pHead = pChunk->chain.pTail = NULL;
+        pChunk->chain.lines = 0;
+        pChunk->result = ES_ERROR_SUCCESS;
+    }
+    
+    // The calling thread indexes the first chunk itself. A chunk
+    // without a thread also falls back to the calling thread.
+    for (chunkIndex = 1; chunkIndex < chunks; ++chunkIndex) {
+        threadArr[chunkIndex] = CreateThread(NULL, 0, indexChunk,
+            chunkArr+chunkIndex, 0, NULL);
+        
+    }
+    indexChunk(chunkArr);
+    for (chunkIndex = 1; chunkIndex < chunks; ++chunkIndex) {
+        if (threadArr[chunkIndex] == NULL) {
+            indexChunk(chunkArr+chunkIndex);
+            
+        } else {
+            WaitForSingleObject(threadArr[chunkIndex], INFINITE);
+            CloseHandle(threadArr[chunkIndex]);
+            
+        }
+    }
+    
+    // The last line drops a carriage return that ends the file, which
+    // the follow mode still counts as a byte of the file.
+    tailReturn = pFile[fileBytes-1] == '\r';
+    UnmapViewOfFile(pFile);
+    CloseHandle(hMapping);
+    
+    // The lines keep their text blocks alive without the table.
+    if (internLines) {
+        destructInternTable(&table);
+        
+    }
+    
+    for (chunkIndex = 0; chunkIndex < chunks; ++chunkIndex) {
+        if (chunkArr[chunkIndex].result != ES_ERROR_SUCCESS) {
+            result = chunkArr[chunkIndex].result;
+            
+        }
+    }
+    
+    // Join the chunks in file order. The first line of each chunk is
+    // the running sum of the line counts of the chunks before it, so
+    // the join costs one link per chunk rather than one per line.
+    for (chunkIndex = 0; chunkIndex < chunks; ++chunkIndex) {
+        if (result == ES_ERROR_SUCCESS) {
+            appendChainToDeque(&chunkArr[chunkIndex].chain, pDeque);
+            
+        } else {
+            destructLineChain(&chunkArr[chunkIndex].chain);
+            
+        }
+    }
+    if (result == ES_ERROR_SUCCESS) {
+        pDeque->tailBytes = pDeque->pTail->line.characters + tailReturn;
+        
+    }
+    
+    return result;
+}
+
+static DWORD WINAPI indexChunk(LPVOID pParameter) {
+    
+    sIndexChunk *pChunk = pParameter;
+    const char *pFile = pChunk->pFile;
+    const char *pFeed;
+    size_t lineStart = pChunk->firstByte, limit, consumed;
+    
+    // A chunk owns the lines that start inside it. The line that
+    // straddles the start of the chunk belongs to an earlier chunk.
+    // This includes a line whose CR+LF pair the chunk boundary splits.
+    if (lineStart > 0 && pFile[lineStart-1] != '\n') {
+        pFeed = memchr(pFile+lineStart, '\n',
+            pChunk->lastByte-lineStart);
+        if (pFeed == NULL) {
+            return 0;
+            
+        }
+        lineStart = pFeed - pFile + 1;
+        
+    }
+    if (lineStart >= pChunk->lastByte) {
+        return 0;
+        
+    }
+    
+    // The last line of the chunk extends to the next line feed, even
+    // when the line feed lies in a later chunk.
+    pFeed = memchr(pFile+pChunk->lastByte-1, '\n',
+        pChunk->fileBytes-pChunk->lastByte+1);
+    limit = pFeed == NULL ? pChunk->fileBytes
+        : (size_t) (pFeed-pFile) + 1;
+    
+    // The chunk that reaches the end of the file also produces the
+    // line after the last line feed.
+    pChunk->result = splitLinesIntoChain(pFile+lineStart, limit-lineStart,
+        limit == pChunk->fileBytes, pChunk->pTable, &pChunk->chain, 
+        &consumed);
+    
+    return 0;
+}
@@ -0,0 +1,15 @@
+#include "memory_manager.h"
+
+#ifndef _HEADER_FILE_INDEXER
+
+// Chunks smaller than this size are not worth a thread of their own.
+#define ES_INDEX_MINIMUM_CHUNK_BYTES (4*1024*1024)
+
+// Lines of a typical file, used to size the intern table.
+#define ES_INDEX_BYTES_PER_LINE 32
+
+enum EsError indexFileIntoDeque(HANDLE hFile, sLineDeque *pDeque, 
+    int internLines);
+
+#define _HEADER_FILE_INDEXER
+#endif
@@ -0,0 +1,332 @@
+// Cancelling a blocking read needs Windows Vista or later.
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "follow_mode.h"
+#include "edit_manager.h"
+
+static DWORD WINAPI followSource(LPVOID pParameter);
+static void publishLines(sFollower *pFollower, sLineChain *pChain,
+    sLineNode *pTail, size_t consumedBytes);
+static void moveChain(sLineChain *pFrom, sLineChain *pTo);
+
+// Starts to read the source from where the deque ends. The last line
+// of the deque holds the text after the last line feed, so the next
+// bytes continue it. A carriage return that the last line dropped
+// returns to the text, since the next bytes may not be a line feed.
+enum EsError startFollowing(sFollower *pFollower, HANDLE hSource,
+        sLineDeque *pDeque, unsigned long maximumLines) {
+    
+    const sLine *pTailLine = &pDeque->pTail->line;
+    const int tailReturn = pDeque->tailBytes > pTailLine->characters;
+    unsigned int capacity = ES_FOLLOW_READ_BYTES;
+    
+    // Files continue where the deque ends. Pipes have no position.
+    if (GetFileType(hSource) == FILE_TYPE_DISK) {
+        LARGE_INTEGER position;
+        
+        position.QuadPart = pDeque->loadedBytes;
+        if (!SetFilePointerEx(hSource, position, NULL, FILE_BEGIN)) {
+            return ES_ERROR_PARSING_ERROR;
+            
+        }
+    }
+    
+    while (capacity <= pTailLine->characters + tailReturn) {
+        capacity *= 2;
+    }
+    pFollower->pCarry = malloc(sizeof(char)*capacity);
+    if (pFollower->pCarry == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    memcpy(pFollower->pCarry, LINE_TEXT(pTailLine),
+        sizeof(char)*pTailLine->characters);
+    pFollower->carryCharacters = pTailLine->characters;
+    if (tailReturn) {
+        pFollower->pCarry[pFollower->carryCharacters++] = '\r';
+        
+    }
+    
+    pFollower->hSource = hSource;
+    pFollower->pending.pHead = pFollower->pending.pTail = NULL;
+    pFollower->pending.lines = 0;
+    pFollower->pPendingTail = NULL;
+    pFollower->sourceBytes = pDeque->loadedBytes 
+        - pFollower->carryCharacters;
+    pFollower->maximumLines = maximumLines;
+    pFollower->stopping = FALSE;
+    pFollower->result = ES_ERROR_SUCCESS;
+    InitializeCriticalSection(&pFollower->lock);
+    
+    pFollower->hThread = CreateThread(NULL, 0, followSource, pFollower,
+        0, NULL);
+    if (pFollower->hThread == NULL) {
+        DeleteCriticalSection(&pFollower->lock);
+        free(pFollower->pCarry);
+        return ES_ERROR_FAILED_INITIALIZATION;
+        
+    }
+    
+    return ES_ERROR_SUCCESS;
+}
+
+void stopFollowing(sFollower *pFollower) {
+    
+    InterlockedExchange(&pFollower->stopping, TRUE);
+    
+    // Reading from a pipe blocks until a writer sends bytes. A cancel
+    // that arrives before the thread starts to read cancels nothing, so
+    // cancel again until the thread ends.
+    do {
+        CancelSynchronousIo(pFollower->hThread);
+    } while (WaitForSingleObject(pFollower->hThread, 
+        ES_FOLLOW_CANCEL_MILLISECONDS) == WAIT_TIMEOUT);
+    CloseHandle(pFollower->hThread);
+    
+    destructLineChain(&pFollower->pending);
+    if (pFollower->pPendingTail != NULL) {
+        destructLineNode(pFollower->pPendingTail);
+        
+    }
+    DeleteCriticalSection(&pFollower->lock);
+    free(pFollower->pCarry);
+    
+    return;
+}
+
+// Replaces the last line of the deque with the pending lines and drops
+// the oldest lines past the maximum. Returns the number of lines that
+// took the place of the last line, which is zero when nothing arrived.
+// The dropped lines are lines from the start of the deque.
+unsigned long drainFollower(sFollower *pFollower, sLineDeque *pDeque,
+        unsigned long *pDroppedLines) {
+    
+    sLineChain batch = { 0 };
+    sWriteHead *pHead = &pDeque->writeHead;
+    sLineNode *pStale = pDeque->pTail;
+    sLineNode *pTail;
+    unsigned long appendedLines;
+    
+    *pDroppedLines = 0;
+    
+    // Take the whole batch at once to keep the reader waiting briefly.
+    EnterCriticalSection(&pFollower->lock);
+    pTail = pFollower->pPendingTail;
+    if (pTail == NULL) {
+        LeaveCriticalSection(&pFollower->lock);
+        return 0;
+        
+    }
+    moveChain(&pFollower->pending, &batch);
+    pFollower->pPendingTail = NULL;
+    
+    // The pending tail holds the bytes after the last line feed as they
+    // are, carriage return included.
+    pDeque->tailBytes = pTail->line.characters;
+    pDeque->loadedBytes = pFollower->sourceBytes + pDeque->tailBytes;
+    LeaveCriticalSection(&pFollower->lock);
+    
+    pTail->pNext = NULL;
+    pTail->pPrev = batch.pTail;
+    if (batch.pTail == NULL) {
+        batch.pHead = pTail;
+        
+    } else {
+        batch.pTail->pNext = pTail;
+        
+    }
+    batch.pTail = pTail;
+    ++(batch.lines);
+    appendedLines = batch.lines;
+    
+    // The first line of the batch continues the stale last line.
+    pDeque->pTail = pStale->pPrev;
+    if (pDeque->pTail == NULL) {
+        pDeque->pHead = NULL;
+        
+    } else {
+        pDeque->pTail->pNext = NULL;
+        
+    }
+    --(pDeque->lines);
+    
+    if (pHead->pNode == pStale) {
+        pHead->pNode = batch.pHead;
+        if (pHead->characterIndex > batch.pHead->line.characters) {
+            pHead->characterIndex = batch.pHead->line.characters;
+            
+        }
+    }
+    destructLineNode(pStale);
+    
+    appendChainToDeque(&batch, pDeque);
+    
+    // Drop the oldest lines to bound the memory of the document.
+    if (pFollower->maximumLines > 0
+            && pDeque->lines > pFollower->maximumLines) {
+        const unsigned long droppedLines = pDeque->lines
+            - pFollower->maximumLines;
+        unsigned long lineIndex;
+        
+        for (lineIndex = 0; lineIndex < droppedLines; ++lineIndex) {
+            sLineNode *pOldest = pDeque->pHead;
+            
+            pDeque->pHead = pOldest->pNext;
+            pDeque->pHead->pPrev = NULL;
+            if (pHead->pNode == pOldest) {
+                pHead->pNode = pDeque->pHead;
+                pHead->characterIndex = 0;
+                
+            }
+            destructLineNode(pOldest);
+        }
+        pDeque->lines -= droppedLines;
+        
+        pHead->lineIndex = pHead->lineIndex > droppedLines
+            ? pHead->lineIndex - droppedLines : 0;
+        *pDroppedLines = droppedLines;
+        
+    }
+    
+    // Undo entries may refer to the replaced or the dropped lines.
+    clearUndoHistory(pDeque);
+    
+    return appendedLines;
+}
+
+static DWORD WINAPI followSource(LPVOID pParameter) {
+    
+    sFollower *pFollower = pParameter;
+    size_t capacity = ES_FOLLOW_READ_BYTES;
+    
+    while (capacity <= pFollower->carryCharacters) {
+        capacity *= 2;
+    }
+    
+    while (!pFollower->stopping) {
+        sLineChain chain = { 0 };
+        sLineNode *pTail;
+        DWORD readBytes;
+        size_t consumed, carried = pFollower->carryCharacters;
+        
+        // A line longer than the buffer needs a bigger buffer.
+        if (carried == capacity) {
+            char *pGrown = realloc(pFollower->pCarry,
+                sizeof(char)*capacity*2);
+            
+            if (pGrown == NULL) {
+                pFollower->result = ES_ERROR_ALLOCATION_FAIL;
+                break;
+                
+            }
+            pFollower->pCarry = pGrown;
+            capacity *= 2;
+            
+        }
+        
+        // Reading fails when the last writer closes a pipe, and when
+        // the editor cancels the read.
+        if (!ReadFile(pFollower->hSource, pFollower->pCarry+carried,
+                (DWORD) (capacity-carried), &readBytes, NULL)) {
+            break;
+            
+        }
+        
+        // A file without new bytes may still grow.
+        if (readBytes == 0) {
+            Sleep(ES_FOLLOW_POLL_MILLISECONDS);
+            continue;
+            
+        }
+        
+        carried += readBytes;
+        pFollower->result = splitLinesIntoChain(pFollower->pCarry, carried,
+            FALSE, NULL, &chain, &consumed);
+        if (pFollower->result != ES_ERROR_SUCCESS) {
+            destructLineChain(&chain);
+            break;
+            
+        }
+        pTail = constructLineNode(carried - consumed);
+        if (pTail == NULL) {
+            destructLineChain(&chain);
+            pFollower->result = ES_ERROR_ALLOCATION_FAIL;
+            break;
+            
+        }
+        
+        // Keep the text after the last line feed for the next read,
+        // and show it as the last line in the meantime.
+        memmove(pFollower->pCarry, pFollower->pCarry+consumed,
+            sizeof(char)*(carried-consumed));
+        pFollower->carryCharacters = carried - consumed;
+        memcpy(LINE_TEXT(&pTail->line), pFollower->pCarry,
+            sizeof(char)*pFollower->carryCharacters);
+        
+        publishLines(pFollower, &chain, pTail, consumed);
+    }
+    
+    return 0;
+}
+
+// Hands lines to the editor. A full ring already drops lines here, so
+// that a slow editor never holds more lines than the maximum.
+static void publishLines(sFollower *pFollower, sLineChain *pChain,
+        sLineNode *pTail, size_t consumedBytes) {
+    
+    sLineNode *pPreviousTail;
+    
+    EnterCriticalSection(&pFollower->lock);
+    moveChain(pChain, &pFollower->pending);
+    pPreviousTail = pFollower->pPendingTail;
+    pFollower->pPendingTail = pTail;
+    pFollower->sourceBytes += consumedBytes;
+    
+    while (pFollower->maximumLines > 0
+            && pFollower->pending.lines > pFollower->maximumLines) {
+        sLineNode *pOldest = pFollower->pending.pHead;
+        
+        pFollower->pending.pHead = pOldest->pNext;
+        pFollower->pending.pHead->pPrev = NULL;
+        --(pFollower->pending.lines);
+        destructLineNode(pOldest);
+    }
+    LeaveCriticalSection(&pFollower->lock);
+    
+    // The new tail holds all the text of the previous one.
+    if (pPreviousTail != NULL) {
+        destructLineNode(pPreviousTail);
+        
+    }
+    
+    return;
+}
+
+// Moves every node of a chain to the end of another chain.
+static void moveChain(sLineChain *pFrom, sLineChain *pTo) {
+    
+    if (pFrom->pHead == NULL) {
+        return;
+        
+    }
+    
+    pFrom->pHead->pPrev = pTo->pTail;
+    if (pTo->pTail == NULL) {
+        pTo->pHead = pFrom->pHead;
+        
+    } else {
+        pTo->pTail->pNext = pFrom->pHead;
+        
+    }
+    pTo->pTail = pFrom->pTail;
+    pTo->lines += pFrom->lines;
+    
+    pFrom->pHead = pFrom->pTail = NULL;
+    pFrom->lines = 0;
+    
+    return;
+}
\ No newline at end of file
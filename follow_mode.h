@@ -0,0 +1,44 @@
+#include "memory_manager.h"
+
+#ifndef _HEADER_FOLLOW_MODE
+
+// Bytes that the follower reads at once. Longer lines grow the buffer.
+#define ES_FOLLOW_READ_BYTES (1024*1024)
+// Delay before reading a file that has no new bytes again.
+#define ES_FOLLOW_POLL_MILLISECONDS 50
+// Delay between two batches of lines reaching the editor.
+#define ES_FOLLOW_FRAME_MILLISECONDS 16
+// Delay before cancelling the read of the thread again on stopping.
+#define ES_FOLLOW_CANCEL_MILLISECONDS 10
+
+// Lines that the follow mode keeps before it drops the oldest lines.
+// Zero keeps every line.
+#define ES_FOLLOW_MAXIMUM_LINES 0
+#define ES_FOLLOW_TIMER_ID 1
+
+// Reads new lines from a growing file or a pipe on its own thread. The
+// editor takes the lines in batches, so that repainting happens at 
+// most once per batch. The last line of the document always holds the
+// text after the last line feed, and each batch replaces it.
+typedef struct {
+    HANDLE hSource;
+    HANDLE hThread;
+    CRITICAL_SECTION lock;          // Guards the pending fields.
+    sLineChain pending;             // Lines the editor did not take.
+    sLineNode *pPendingTail;        // Text after the last line feed.
+    unsigned long long sourceBytes; // Bytes up to the pending tail.
+    char *pCarry;                   // Read buffer of the thread.
+    unsigned int carryCharacters;
+    unsigned long maximumLines;     // Zero keeps every line.
+    LONG volatile stopping;
+    enum EsError result;
+} sFollower;
+
+enum EsError startFollowing(sFollower *pFollower, HANDLE hSource, 
+    sLineDeque *pDeque, unsigned long maximumLines);
+void stopFollowing(sFollower *pFollower);
+unsigned long drainFollower(sFollower *pFollower, sLineDeque *pDeque, 
+    unsigned long *pDroppedLines);
+
+#define _HEADER_FOLLOW_MODE
+#endif
@@ -9,14 +9,22 @@
 #define ES_LAYOUT_LINECOUNT_FONT_HEIGHT 20
 #define ES_LAYOUT_LINECOUNT_FONT_WIDTH (ES_LAYOUT_LINECOUNT_FONT_HEIGHT/2)
 #define ES_LAYOUT_LINECOUNT_WIDTH (5*ES_LAYOUT_LINECOUNT_FONT_WIDTH)
+#define ES_LAYOUT_DIFF_MARKER_WIDTH 4
 
 #define ES_COLOR_BACKGROUND RGB(10,15,30)
 #define ES_COLOR_LINECOUNT RGB(40,50,60)
 #define ES_COLOR_HIGHLIGHT RGB(25,30,45)
 #define ES_COLOR_WHITE RGB(255,255,255)
+#define ES_COLOR_DIFF_ADDED RGB(70,150,90)
+#define ES_COLOR_DIFF_CHANGED RGB(70,120,180)
+#define ES_COLOR_DIFF_REMOVED RGB(180,70,70)
+#define ES_COLOR_SELECTION RGB(45,70,110)
 
 #define ES_SCROLL_NUMBNESS 17
 
+// Identical lines of a loaded file share their text.
+#define ES_INTERN_LINES TRUE
+
 #define PANIC(message) (MessageBox(NULL, message, NULL, MB_OK), PostQuitMessage(0), (void) 0)
 
 enum EsError {
@@ -26,6 +34,9 @@ enum EsError {
     ES_ERROR_FILE_NOT_FOUND,
     ES_ERROR_PARSING_ERROR,
     ES_ERROR_ALLOCATION_FAIL,
+    ES_ERROR_INVALID_EDIT,
+    ES_ERROR_NOTHING_TO_UNDO,
+    ES_ERROR_TEMPORARY_FILE,
 };
 
 typedef struct WriteHead {
@@ -38,6 +49,14 @@ typedef struct {
     struct LineDeque *dequeArr;
     sWriteHead *pActiveHead;
     unsigned long firstVisibleLineIndex;
+    unsigned long firstVisibleRowInLine;
+    struct WrapLayout *pWrapLayout;
+    struct Diff *pDiff;
+    unsigned char internLines;
+    // The selection runs from the anchor to the active write head.
+    sWriteHead selectionAnchor;
+    unsigned char selecting;
+    struct Clip *pClipboard;
     struct {
         unsigned short relativeFocusLineIndex;
         unsigned short top;
@@ -0,0 +1,497 @@
+#include <stdlib.h>
+#include <string.h>
+#include "input_trace.h"
+
+// Traces are text. Each event takes a line that holds its delay in
+// microseconds, the name of its message, its parameters in hexadecimal
+// and the held modifier keys, such as `15000 keydown 28 1500001 -`.
+// The `fixture 4000 test.txt` line names the document that the editor
+// opened and how many times the replay repeats it. Lines that start
+// with a number sign are comments.
+
+static int compareMicroseconds(const void *pLeft, const void *pRight);
+static int compareAllocations(const void *pLeft, const void *pRight);
+static unsigned long percentileIndex(unsigned long events,
+    unsigned int perMille);
+static sRepaint dispatchTraceEvent(sEditorCore *pCore, 
+    const sInputEvent *pEvent);
+
+static const struct {
+    const char *pName;
+    unsigned int messageId;
+} traceMessageArr[] = {
+    {"keydown", WM_KEYDOWN},
+    {"wheel", WM_MOUSEWHEEL},
+    {"click", WM_LBUTTONDOWN},
+};
+#define ES_TRACE_MESSAGES \
+    (sizeof(traceMessageArr)/sizeof(*traceMessageArr))
+
+static const char *const modifierNameArr[] = {"-", "c", "s", "cs"};
+
+// The build links every call to these functions through the wrappers
+// below, which count the allocations that a replayed event makes.
+void *__real_malloc(size_t bytes);
+void *__real_calloc(size_t count, size_t bytes);
+void *__real_realloc(void *pBlock, size_t bytes);
+void *__wrap_malloc(size_t bytes);
+void *__wrap_calloc(size_t count, size_t bytes);
+void *__wrap_realloc(void *pBlock, size_t bytes);
+
+// Threads of the indexer, the sort and the follow mode allocate too.
+static volatile LONG allocationCount = 0;
+
+// Creates the trace file and notes the document of the session in it.
+enum EsError startRecording(sTraceRecorder *pRecorder, const char *pPath,
+        const char *pDocumentPath, unsigned long long (*pClock)(void)) {
+    
+    pRecorder->pFile = fopen(pPath, "w");
+    if (pRecorder->pFile == NULL) {
+        return ES_ERROR_FILE_NOT_FOUND;
+        
+    }
+    pRecorder->pClock = pClock;
+    pRecorder->lastMicroseconds = pClock();
+    
+    fprintf(pRecorder->pFile, "# Edit# input trace\nfixture 1 %s\n",
+        pDocumentPath);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Appends an event to the trace. Each event reaches the file at once,
+// so that a trace of a session that crashes still ends in its crash.
+void recordInputEvent(sTraceRecorder *pRecorder, unsigned int messageId,
+        WPARAM wParam, LPARAM lParam) {
+    
+    unsigned long long now, delay;
+    unsigned int modifiers = 0;
+    unsigned int messageIndex;
+    
+    for (messageIndex = 0; messageIndex < ES_TRACE_MESSAGES;
+            ++messageIndex) {
+        if (traceMessageArr[messageIndex].messageId == messageId) {
+            break;
+            
+        }
+    }
+    if (pRecorder->pFile == NULL || messageIndex == ES_TRACE_MESSAGES) {
+        return;
+        
+    }
+    
+    if (GetKeyState(VK_CONTROL) < 0) {
+        modifiers |= ES_MODIFIER_CONTROL;
+        
+    }
+    if (GetKeyState(VK_SHIFT) < 0) {
+        modifiers |= ES_MODIFIER_SHIFT;
+        
+    }
+    now = pRecorder->pClock();
+    delay = now - pRecorder->lastMicroseconds;
+    if (delay > 0xFFFFFFFFUL) {
+        delay = 0xFFFFFFFFUL;
+        
+    }
+    pRecorder->lastMicroseconds = now;
+    
+    fprintf(pRecorder->pFile, "%lu %s %lx %lx %s\n",
+        (unsigned long) delay, traceMessageArr[messageIndex].pName,
+        (unsigned long) (wParam & 0xFFFFFFFFUL),
+        (unsigned long) (lParam & 0xFFFFFFFFUL),
+        modifierNameArr[modifiers]);
+    fflush(pRecorder->pFile);
+    
+    return;
+}
+
+void stopRecording(sTraceRecorder *pRecorder) {
+    
+    if (pRecorder->pFile != NULL) {
+        fclose(pRecorder->pFile);
+        pRecorder->pFile = NULL;
+        
+    }
+    
+    return;
+}
+
+enum EsError loadInputTrace(sInputTrace *pTrace, const char *pPath) {
+    
+    FILE *pFile = fopen(pPath, "r");
+    char line[ES_TRACE_LINE_CHARACTERS+2];
+    unsigned long capacity = 0;
+    enum EsError result = ES_ERROR_SUCCESS;
+    
+    pTrace->fixturePath[0] = '\0';
+    pTrace->copies = 0;
+    pTrace->pEventArr = NULL;
+    pTrace->events = 0;
+    if (pFile == NULL) {
+        return ES_ERROR_FILE_NOT_FOUND;
+        
+    }
+    
+    while (result == ES_ERROR_SUCCESS
+            && fgets(line, sizeof(line), pFile) != NULL) {
+        size_t length = strlen(line);
+        char name[16], modifiers[3];
+        unsigned long delay, wBits, lBits, copies;
+        unsigned int messageIndex;
+        int pathOffset;
+        sInputEvent *pEvent;
+        
+        if (length > 0 && line[length-1] == '\n') {
+            line[--length] = '\0';
+            
+        } else if (!feof(pFile)) {
+            result = ES_ERROR_PARSING_ERROR;
+            break;
+            
+        }
+        if (length > 0 && line[length-1] == '\r') {
+            line[--length] = '\0';
+            
+        }
+        if (length == 0 || line[0] == '#') {
+            continue;
+            
+        }
+        
+        if (sscanf(line, "fixture %lu %n", &copies, &pathOffset) == 1) {
+            if (copies == 0 || copies > ES_TRACE_MAXIMUM_COPIES
+                    || line[pathOffset] == '\0'
+                    || length - pathOffset > MAX_PATH) {
+                result = ES_ERROR_PARSING_ERROR;
+                break;
+                
+            }
+            strcpy(pTrace->fixturePath, line + pathOffset);
+            pTrace->copies = copies;
+            continue;
+            
+        }
+        
+        if (sscanf(line, "%lu %15s %lx %lx %2s", &delay, name, &wBits,
+                &lBits, modifiers) != 5) {
+            result = ES_ERROR_PARSING_ERROR;
+            break;
+            
+        }
+        for (messageIndex = 0; messageIndex < ES_TRACE_MESSAGES;
+                ++messageIndex) {
+            if (strcmp(traceMessageArr[messageIndex].pName, name) == 0) {
+                break;
+                
+            }
+        }
+        if (messageIndex == ES_TRACE_MESSAGES) {
+            result = ES_ERROR_PARSING_ERROR;
+            break;
+            
+        }
+        
+        if (pTrace->events == capacity) {
+            sInputEvent *pGrown;
+            
+            capacity = capacity == 0 ? 256 : 2*capacity;
+            pGrown = realloc(pTrace->pEventArr,
+                sizeof(sInputEvent)*capacity);
+            if (pGrown == NULL) {
+                result = ES_ERROR_ALLOCATION_FAIL;
+                break;
+                
+            }
+            pTrace->pEventArr = pGrown;
+            
+        }
+        
+        pEvent = pTrace->pEventArr + pTrace->events++;
+        pEvent->delayMicroseconds = delay;
+        pEvent->messageId = traceMessageArr[messageIndex].messageId;
+        pEvent->wParam = (WPARAM) wBits;
+        // Negative positions come back through the sign of the low bits.
+        pEvent->lParam = (LPARAM) (LONG) lBits;
+        pEvent->modifiers = 0;
+        if (strchr(modifiers, 'c') != NULL) {
+            pEvent->modifiers |= ES_MODIFIER_CONTROL;
+            
+        }
+        if (strchr(modifiers, 's') != NULL) {
+            pEvent->modifiers |= ES_MODIFIER_SHIFT;
+            
+        }
+    }
+    fclose(pFile);
+    
+    if (result == ES_ERROR_SUCCESS && pTrace->copies == 0) {
+        result = ES_ERROR_PARSING_ERROR;
+        
+    }
+    if (result != ES_ERROR_SUCCESS) {
+        destructInputTrace(pTrace);
+        
+    }
+    
+    return result;
+}
+
+void destructInputTrace(sInputTrace *pTrace) {
+    
+    free(pTrace->pEventArr);
+    pTrace->pEventArr = NULL;
+    pTrace->events = 0;
+    
+    return;
+}
+
+// Writes the copies of the fixture into a new temporary file, whose
+// path lands in `pPath`, which holds `MAX_PATH+1` characters. The
+// caller deletes the file once the editor lets go of it.
+enum EsError writeTraceFixture(const sInputTrace *pTrace, char *pPath) {
+    
+    char folder[MAX_PATH+1];
+    HANDLE hSource, hFixture;
+    LARGE_INTEGER size;
+    DWORD bytes = 0, written;
+    char *pBytes = NULL;
+    unsigned long copy;
+    enum EsError result = ES_ERROR_SUCCESS;
+    
+    hSource = CreateFile(pTrace->fixturePath,
+        GENERIC_READ,
+        FILE_SHARE_READ|FILE_SHARE_WRITE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+    if (hSource == INVALID_HANDLE_VALUE) {
+        return ES_ERROR_FILE_NOT_FOUND;
+        
+    }
+    
+    // Fixtures are small, so that a single read takes all of one.
+    if (!GetFileSizeEx(hSource, &size) || size.QuadPart >= MAXLONG
+            || (pBytes = malloc(sizeof(char)*(size.QuadPart+1))) == NULL
+            || !ReadFile(hSource, pBytes, (DWORD) size.QuadPart, &bytes,
+            NULL) || bytes != (DWORD) size.QuadPart) {
+        result = ES_ERROR_FILE_NOT_FOUND;
+        
+    }
+    CloseHandle(hSource);
+    if (result != ES_ERROR_SUCCESS) {
+        free(pBytes);
+        return result;
+        
+    }
+    
+    // Copies must not run into each other's last line.
+    if (bytes > 0 && pBytes[bytes-1] != '\n') {
+        pBytes[bytes++] = '\n';
+        
+    }
+    
+    if (GetTempPath(sizeof(folder), folder) == 0
+            || GetTempFileName(folder, "es", 0, pPath) == 0) {
+        free(pBytes);
+        return ES_ERROR_TEMPORARY_FILE;
+        
+    }
+    hFixture = CreateFile(pPath,
+        GENERIC_WRITE,
+        0,
+        NULL,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY,
+        NULL);
+    if (hFixture == INVALID_HANDLE_VALUE) {
+        DeleteFile(pPath);
+        free(pBytes);
+        return ES_ERROR_TEMPORARY_FILE;
+        
+    }
+    
+    for (copy = 0; copy < pTrace->copies; ++copy) {
+        if (!WriteFile(hFixture, pBytes, bytes, &written, NULL)
+                || written != bytes) {
+            result = ES_ERROR_TEMPORARY_FILE;
+            break;
+            
+        }
+    }
+    CloseHandle(hFixture);
+    free(pBytes);
+    if (result != ES_ERROR_SUCCESS) {
+        DeleteFile(pPath);
+        
+    }
+    
+    return result;
+}
+
+// Feeds the events of a trace to the editor core, and lays out the view
+// after each event that changed it in place of the paint that ends the
+// frame. No window exists, so the times leave out drawing and the
+// message queue. Background work may take the pause that followed each
+// event in the trace, as it would have in the session.
+void replayInputTrace(sEditorCore *pCore, const sInputTrace *pTrace,
+        FILE *pReport) {
+    
+    unsigned long long (*const pClock)(void) = pCore->pScheduler->pClock;
+    unsigned long long *pMicrosecondsArr = 
+        malloc(sizeof(unsigned long long)*(pTrace->events+1));
+    unsigned long *pAllocationsArr = 
+        malloc(sizeof(unsigned long)*(pTrace->events+1));
+    unsigned long eventIndex;
+    
+    if (pMicrosecondsArr == NULL || pAllocationsArr == NULL) {
+        free(pMicrosecondsArr);
+        free(pAllocationsArr);
+        PANIC("The replay ran out of memory.");
+        return;
+        
+    }
+    
+    for (eventIndex = 0; eventIndex < pTrace->events; ++eventIndex) {
+        const sInputEvent *pEvent = pTrace->pEventArr + eventIndex;
+        unsigned long long now = pClock();
+        const unsigned long long pauseEnd = now 
+            + pEvent->delayMicroseconds;
+        unsigned long allocations;
+        sRepaint repaint;
+        
+        while (now < pauseEnd && runTaskSlice(pCore->pScheduler,
+                pauseEnd - now < ES_TASK_SLICE_MICROSECONDS ?
+                pauseEnd - now : ES_TASK_SLICE_MICROSECONDS)) {
+            now = pClock();
+        }
+        
+        allocations = countAllocations();
+        now = pClock();
+        repaint = dispatchTraceEvent(pCore, pEvent);
+        if (repaint.changed) {
+            layoutEditorFrame(pCore);
+            
+        }
+        pMicrosecondsArr[eventIndex] = pClock() - now;
+        pAllocationsArr[eventIndex] = countAllocations() - allocations;
+    }
+    
+    reportLatencies(pReport, pMicrosecondsArr, pAllocationsArr, 
+        pTrace->events);
+    free(pMicrosecondsArr);
+    free(pAllocationsArr);
+    
+    return;
+}
+
+// Hands an event to the core function that the window procedure calls
+// for its message.
+static sRepaint dispatchTraceEvent(sEditorCore *pCore, 
+        const sInputEvent *pEvent) {
+    
+    switch (pEvent->messageId) {
+        case WM_KEYDOWN:
+            return pressEditorKey(pCore, pEvent->wParam, pEvent->modifiers);
+        case WM_MOUSEWHEEL:
+            return scrollEditor(pCore, 
+                GET_WHEEL_DELTA_WPARAM(pEvent->wParam));
+        default:
+            return clickEditor(pCore, 0xFFFF & pEvent->lParam, 
+                0xFFFF & (pEvent->lParam >> 16), pEvent->modifiers);
+    }
+}
+
+// Counts the allocations of the process so far. Counts wrap around, so
+// callers only look at differences.
+unsigned long countAllocations(void) {
+    return (unsigned long) allocationCount;
+}
+
+void *__wrap_malloc(size_t bytes) {
+    InterlockedIncrement(&allocationCount);
+    return __real_malloc(bytes);
+}
+
+void *__wrap_calloc(size_t count, size_t bytes) {
+    InterlockedIncrement(&allocationCount);
+    return __real_calloc(count, bytes);
+}
+
+void *__wrap_realloc(void *pBlock, size_t bytes) {
+    InterlockedIncrement(&allocationCount);
+    return __real_realloc(pBlock, bytes);
+}
+
+// Prints the percentiles of the time from each event to the end of its
+// frame, and of the allocations that each event made. Sorts both
+// arrays in place.
+void reportLatencies(FILE *pReport, unsigned long long *pMicrosecondsArr,
+        unsigned long *pAllocationsArr, unsigned long events) {
+    
+    const unsigned int perMilleArr[] = {500, 990, 999, 1000};
+    unsigned long long totalAllocations = 0;
+    unsigned long eventIndex;
+    
+    fprintf(pReport, "%lu events\n", events);
+    if (events == 0) {
+        return;
+        
+    }
+    
+    qsort(pMicrosecondsArr, events, sizeof(*pMicrosecondsArr),
+        &compareMicroseconds);
+    qsort(pAllocationsArr, events, sizeof(*pAllocationsArr),
+        &compareAllocations);
+    for (eventIndex = 0; eventIndex < events; ++eventIndex) {
+        totalAllocations += pAllocationsArr[eventIndex];
+    }
+    
+    fprintf(pReport,
+        "latency p50 %lu us, p99 %lu us, p99.9 %lu us, max %lu us\n",
+        (unsigned long) pMicrosecondsArr[percentileIndex(events,
+            perMilleArr[0])],
+        (unsigned long) pMicrosecondsArr[percentileIndex(events,
+            perMilleArr[1])],
+        (unsigned long) pMicrosecondsArr[percentileIndex(events,
+            perMilleArr[2])],
+        (unsigned long) pMicrosecondsArr[percentileIndex(events,
+            perMilleArr[3])]);
+    fprintf(pReport,
+        "allocations p50 %lu, p99 %lu, p99.9 %lu, max %lu, mean %.1f\n",
+        pAllocationsArr[percentileIndex(events, perMilleArr[0])],
+        pAllocationsArr[percentileIndex(events, perMilleArr[1])],
+        pAllocationsArr[percentileIndex(events, perMilleArr[2])],
+        pAllocationsArr[percentileIndex(events, perMilleArr[3])],
+        (double) totalAllocations / events);
+    
+    return;
+}
+
+static int compareMicroseconds(const void *pLeft, const void *pRight) {
+    
+    const unsigned long long left = *(const unsigned long long *) pLeft;
+    const unsigned long long right = *(const unsigned long long *) pRight;
+    
+    return (left > right) - (left < right);
+}
+
+static int compareAllocations(const void *pLeft, const void *pRight) {
+    
+    const unsigned long left = *(const unsigned long *) pLeft;
+    const unsigned long right = *(const unsigned long *) pRight;
+    
+    return (left > right) - (left < right);
+}
+
+// Takes the nearest rank, so that each percentile is an event that
+// happened rather than a blend of two.
+static unsigned long percentileIndex(unsigned long events,
+        unsigned int perMille) {
+    
+    const unsigned long long rank =
+        ((unsigned long long) events*perMille + 999) / 1000;
+    
+    return rank == 0 ? 0 : (unsigned long) (rank - 1);
+}
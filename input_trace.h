@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include "global_data.h"
+#include "editor_core.h"
+
+#ifndef _HEADER_INPUT_TRACE
+
+// Environment variables that name a trace file. The editor records its
+// session into the first one, or replays the second one against the
+// editor core without opening a window, and prints how long each event
+// took up to the end of its frame.
+#define ES_TRACE_RECORD_VARIABLE "EDITSHARP_RECORD"
+#define ES_TRACE_REPLAY_VARIABLE "EDITSHARP_REPLAY"
+
+// Size of the view that a replay lays out, which is the first size of
+// the window less its title bar.
+#define ES_TRACE_VIEW_WIDTH 720
+#define ES_TRACE_VIEW_HEIGHT 500
+
+// Characters that a line of a trace may hold.
+#define ES_TRACE_LINE_CHARACTERS (MAX_PATH+64)
+// Copies of its fixture that a trace may ask for.
+#define ES_TRACE_MAXIMUM_COPIES 100000
+
+// An input message of a recorded session, with the modifier keys that
+// were held. Only the low 32 bits of the parameters are kept, which is
+// all that the recorded messages use.
+typedef struct {
+    unsigned long delayMicroseconds;    // Since the previous event.
+    unsigned int messageId;
+    WPARAM wParam;
+    LPARAM lParam;
+    unsigned int modifiers;
+} sInputEvent;
+
+typedef struct {
+    FILE *pFile;
+    unsigned long long (*pClock)(void);
+    unsigned long long lastMicroseconds;
+} sTraceRecorder;
+
+// A trace replays over copies of its fixture, so that a small file
+// checked in next to the trace stands for a large document.
+typedef struct {
+    char fixturePath[MAX_PATH+1];
+    unsigned long copies;
+    sInputEvent *pEventArr;
+    unsigned long events;
+} sInputTrace;
+
+enum EsError startRecording(sTraceRecorder *pRecorder, const char *pPath,
+    const char *pDocumentPath, unsigned long long (*pClock)(void));
+void recordInputEvent(sTraceRecorder *pRecorder, unsigned int messageId,
+    WPARAM wParam, LPARAM lParam);
+void stopRecording(sTraceRecorder *pRecorder);
+enum EsError loadInputTrace(sInputTrace *pTrace, const char *pPath);
+void destructInputTrace(sInputTrace *pTrace);
+enum EsError writeTraceFixture(const sInputTrace *pTrace, char *pPath);
+void replayInputTrace(sEditorCore *pCore, const sInputTrace *pTrace,
+    FILE *pReport);
+unsigned long countAllocations(void);
+void reportLatencies(FILE *pReport, unsigned long long *pMicrosecondsArr,
+    unsigned long *pAllocationsArr, unsigned long events);
+
+#define _HEADER_INPUT_TRACE
+#endif
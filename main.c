@@ -1,11 +1,78 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "global_data.h"
 #include "init.h"
+#include "task_scheduler.h"
+#include "editor_core.h"
+#include "input_trace.h"
 
 LRESULT editorProcedure(HWND windowHandle, unsigned int messageId, 
     WPARAM primary, LPARAM secondary);
+unsigned long long readMicroseconds(void);
+int isInputPending(void);
+
+// Background work of the editor, which runs while no input waits.
+static sTaskScheduler editorScheduler;
+// The document that the editor opens.
+static const char *pEditorDocument = "test.txt";
+// Takes down the input of the session when a trace is recorded.
+static sTraceRecorder editorRecorder = { NULL };
 
 int main(void) {
+    const char *pReplayPath = getenv(ES_TRACE_REPLAY_VARIABLE);
+    const char *pRecordPath = getenv(ES_TRACE_RECORD_VARIABLE);
+    char fixturePath[MAX_PATH+1];
+    sInputTrace trace;
+    
+    constructTaskScheduler(&editorScheduler, &readMicroseconds, 
+        &isInputPending);
+    
+    // A replay opens the copies of the fixture of its trace. Piped text
+    // cannot be replayed, so sessions over it go unrecorded.
+    if (pReplayPath != NULL) {
+        if (loadInputTrace(&trace, pReplayPath) != ES_ERROR_SUCCESS
+                || writeTraceFixture(&trace, fixturePath) 
+                != ES_ERROR_SUCCESS) {
+            destructInputTrace(&trace);
+            PANIC("The trace to replay cannot be read.");
+            return ES_ERROR_FAILED_INITIALIZATION;
+            
+        }
+        
+    } else if (pRecordPath != NULL 
+            && GetFileType(GetStdHandle(STD_INPUT_HANDLE)) 
+            != FILE_TYPE_PIPE
+            && startRecording(&editorRecorder, pRecordPath, 
+            pEditorDocument, &readMicroseconds) != ES_ERROR_SUCCESS) {
+        PANIC("The trace cannot be recorded.");
+        return ES_ERROR_FAILED_INITIALIZATION;
+        
+    }
+    
+    // A replay runs without a window, against the core alone.
+    if (pReplayPath != NULL) {
+        sEditorCore editorCore;
+        
+        constructEditorCore(&editorCore, &editorScheduler);
+        if (openEditorDocument(&editorCore, fixturePath) 
+                != ES_ERROR_SUCCESS) {
+            PANIC("The fixture of the trace cannot be opened.");
+            
+        } else {
+            resizeEditor(&editorCore, ES_TRACE_VIEW_WIDTH, 
+                ES_TRACE_VIEW_HEIGHT);
+            replayInputTrace(&editorCore, &trace, stdout);
+            
+        }
+        destructEditorCore(&editorCore);
+        destructInputTrace(&trace);
+        destructTaskScheduler(&editorScheduler);
+        DeleteFile(fixturePath);
+        return ES_ERROR_SUCCESS;
+        
+    }
+    
     HWND hEditor = initEditor(&editorProcedure);
     
     if (hEditor == NULL) {
@@ -13,22 +80,57 @@ int main(void) {
         return ES_ERROR_FAILED_INITIALIZATION;
     }
     
+    // Handle every waiting message before a slice of background work,
+    // and sleep until the next message once no work remains.
     MSG currentMessage;
-    while (GetMessage(&currentMessage,NULL,0,0) > 0) {
-        DispatchMessage(&currentMessage);
+    for (;;) {
+        while (PeekMessage(&currentMessage, NULL, 0, 0, PM_REMOVE)) {
+            if (currentMessage.message == WM_QUIT) {
+                stopRecording(&editorRecorder);
+                destructTaskScheduler(&editorScheduler);
+                return ES_ERROR_SUCCESS;
+                
+            }
+            DispatchMessage(&currentMessage);
+        }
+        
+        if (!runTaskSlice(&editorScheduler, ES_TASK_SLICE_MICROSECONDS)) {
+            WaitMessage();
+            
+        }
     }
+}
+
+unsigned long long readMicroseconds(void) {
+    
+    LARGE_INTEGER counter, frequency;
     
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
     
-    return ES_ERROR_SUCCESS;
+    // Split the conversion to keep the product from overflowing.
+    return counter.QuadPart / frequency.QuadPart * 1000000
+        + counter.QuadPart % frequency.QuadPart * 1000000 
+        / frequency.QuadPart;
+}
+
+int isInputPending(void) {
+    return HIWORD(GetQueueStatus(QS_INPUT)) != 0;
 }
 
 #include "memory_manager.h"
+#include "wrap_layout.h"
+#include "diff_manager.h"
 #include "dpi_manager.h"
 
-RECT updateHighlight(sEditorState* pEditorState,
-        const unsigned short windowWidth,
-        const unsigned short curRelativeIndex);
-void jumpHead(sEditorState *pState, const RECT *pRefreshRectangle);
+unsigned int readModifiers(void);
+void invalidateRepaint(HWND hWindow, sRepaint repaint);
+void paintDiffMarker(HDC hCanvas, const sDiff *pDiff, 
+    unsigned long lineIndex, long top, int firstRow);
+void showMemoryStats(HWND hWindow, const sLineDeque *pDeque);
+void paintSelection(HDC hCanvas, const sEditorState *pState, 
+    unsigned long lineIndex, const sLine *pLine, unsigned int rowStart, 
+    unsigned int rowEnd, long top);
 
 LRESULT editorProcedure(HWND hWindow,
         unsigned int messageId,
@@ -44,9 +146,13 @@ LRESULT editorProcedure(HWND hWindow,
     static HFONT hMonospaceFont = NULL;         // Font for code.
     
     static unsigned short titlebarHeight = 0;     // Titlebar height.
-    static unsigned short editorWidth = 0, editorHeight = 0;
     static RECT currentWindowRect = { 0 };      // Current window size.
-    static sEditorState editorState = { 0 };    // System to change.
+    static sEditorCore editorCore;              // System to change.
+    
+    if (editorRecorder.pFile != NULL) {
+        recordInputEvent(&editorRecorder, messageId, wParam, lParam);
+        
+    }
     
     switch(messageId) {
         
@@ -95,15 +201,31 @@ LRESULT editorProcedure(HWND hWindow,
                 + GetSystemMetrics(SM_CYCAPTION) 
                 + GetSystemMetrics(SM_CXPADDEDBORDER);
             
-            if (loadFileIntoEditorState("test.txt", &editorState)
+            constructEditorCore(&editorCore, &editorScheduler);
+            
+            // Text piped into the editor streams into an empty document.
+            if (GetFileType(GetStdHandle(STD_INPUT_HANDLE)) 
+                    == FILE_TYPE_PIPE) {
+                if (followEditorInput(&editorCore, 
+                        GetStdHandle(STD_INPUT_HANDLE)) 
+                        != ES_ERROR_SUCCESS) {
+                    PANIC("The piped text cannot be read.");
+                    
+                } else {
+                    SetTimer(hWindow, ES_FOLLOW_TIMER_ID, 
+                        ES_FOLLOW_FRAME_MILLISECONDS, NULL);
+                    
+                }
+                
+            } else if (openEditorDocument(&editorCore, pEditorDocument) 
                     != ES_ERROR_SUCCESS) {
                 PANIC("The file to edit does not exist.");
                 
+            } else {
+                showMemoryStats(hWindow, editorCore.state.dequeArr);
+                
             }
             
-            /*XXX: Consider multiple open files.*/
-            editorState.pActiveHead = &(editorState.dequeArr[0].writeHead);
-            
             break;
         }
         
@@ -122,9 +244,11 @@ LRESULT editorProcedure(HWND hWindow,
             DeleteObject(hLineHighlightBrush);
             DeleteObject(hMonospaceFont);
             
-            /*XXX: Go to each deque and free its nodes!!!! Then free 
-            the array.*/
-            free(editorState.dequeArr);
+            if (editorCore.following) {
+                KillTimer(hWindow, ES_FOLLOW_TIMER_ID);
+                
+            }
+            destructEditorCore(&editorCore);
             
             PostQuitMessage(0);
             break;
@@ -141,124 +265,31 @@ LRESULT editorProcedure(HWND hWindow,
         
         case WM_KEYDOWN: {
             
-            RECT refreshRectangle;
+            const int following = editorCore.following;
             
-            switch(wParam) {
-                
-                case VK_RETURN: {
-                    sLineNode *pBehind = 
-                        editorState.pActiveHead->pNode->pNext;
-                    sLineNode *pAddition = constructLineNode(0);
-                    
-                    pAddition->pPrev = editorState.pActiveHead->pNode;
-                    pAddition->pNext = pBehind;
-                    
-                    editorState.pActiveHead->pNode->pNext = pAddition;
-                    pBehind->pPrev = pAddition;
-                    
-                    editorState.pActiveHead->pNode = pAddition;
-                    
-                    refreshRectangle = updateHighlight(&editorState, 
-                        editorWidth, 
-                        editorState.curHighlight.relativeFocusLineIndex+1);
-                    refreshRectangle.bottom = editorHeight;
-                    
-                    break;
-                }
-                
-                
-                case VK_BACK: {
-                    
-                    if (editorState.pActiveHead->pNode->line.characters==0
-                            && editorState.pActiveHead->pNode->pPrev!=NULL) {
-                        
-                        sLineNode *pTarget = editorState.pActiveHead->pNode;
-                        sLineNode *pOtherEnd = pTarget->pNext;
-                        
-                        // Move the node that the write head points to back
-                        // one line.
-                        editorState.pActiveHead->pNode = 
-                            editorState.pActiveHead->pNode->pPrev;
-                        
-                        editorState.pActiveHead->pNode->pNext = pOtherEnd;
-                        pOtherEnd->pPrev = editorState.pActiveHead->pNode;
-                        
-                        free(pTarget);
-                        
-                        editorState.prevHighlight.relativeFocusLineIndex
-                            = editorState.curHighlight.relativeFocusLineIndex;
-                        editorState.prevHighlight.top = 
-                            editorState.curHighlight.top;
-                        
-                        refreshRectangle = updateHighlight(&editorState, 
-                            editorWidth, 
-                            editorState.curHighlight.relativeFocusLineIndex
-                            - 1);
-                        refreshRectangle.bottom = editorHeight;
-                        
-                        break;
-                        
-                    }
-                    
-                    // Short-cut to the end to avoid rendering.
-                    return ERROR_SUCCESS;
-                }
+            invalidateRepaint(hWindow, pressEditorKey(&editorCore, wParam, 
+                readModifiers()));
+            
+            // Keys start and stop following the piped text.
+            if (editorCore.following && !following) {
+                SetTimer(hWindow, ES_FOLLOW_TIMER_ID, 
+                    ES_FOLLOW_FRAME_MILLISECONDS, NULL);
                 
-                case VK_UP: {
-                    
-                    if (editorState.pActiveHead->pNode->pPrev != NULL) {
-                        
-                        editorState.pActiveHead->pNode = 
-                            editorState.pActiveHead->pNode->pPrev;
-                        refreshRectangle = updateHighlight(&editorState, 
-                            editorWidth, 
-                            editorState.curHighlight.relativeFocusLineIndex
-                            - 1);
-                        break;
-                        
-                    }
-                    return ERROR_SUCCESS;
-                }
-                case VK_DOWN: {
-                    
-                    if (editorState.pActiveHead->pNode->pNext != NULL) {
-                        
-                        editorState.pActiveHead->pNode = 
-                            editorState.pActiveHead->pNode->pNext;
-                        refreshRectangle = updateHighlight(&editorState, 
-                            editorWidth, 
-                            editorState.curHighlight.relativeFocusLineIndex
-                            + 1);
-                        break;
-                    }
-                    return ERROR_SUCCESS;
-                }
+            } else if (!editorCore.following && following) {
+                KillTimer(hWindow, ES_FOLLOW_TIMER_ID);
                 
             }
-            
-            InvalidateRect(hWindow, &refreshRectangle, TRUE);
             break;
         }
         
         case WM_LBUTTONDOWN: {
             
             // The `lParam` parameter describes the position of the 
-            // user's cursor.
-            const unsigned short clickX = (0xFFFF & lParam), 
-                clickY = (lParam >> 16);
-            const unsigned short lines = clickY
-                / ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
-            RECT refreshRectangle;
-            
-            refreshRectangle = updateHighlight(&editorState, 
-                editorWidth, clickY/ES_LAYOUT_LINECOUNT_FONT_HEIGHT);
-            jumpHead(&editorState, &refreshRectangle);
-            
-            editorState.pActiveHead->characterIndex = 
-                clickX >= ES_LAYOUT_LINECOUNT_WIDTH ?
-                clickX / ES_LAYOUT_LINECOUNT_FONT_WIDTH : 0;
-            
-            InvalidateRect(hWindow, &refreshRectangle, FALSE);
+            // user's cursor. Clicks along with the Shift key extend the 
+            // selection.
+            invalidateRepaint(hWindow, clickEditor(&editorCore, 
+                0xFFFF & lParam, 0xFFFF & (lParam >> 16), 
+                (wParam & MK_SHIFT) ? ES_MODIFIER_SHIFT : 0));
             break;
         }
         
@@ -269,27 +300,24 @@ LRESULT editorProcedure(HWND hWindow,
                 .left = 0, 
                 .top = 0, 
                 .right = ES_LAYOUT_LINECOUNT_WIDTH, 
-                .bottom = editorHeight};
+                .bottom = editorCore.height};
             RECT codeLineRect = {
                 .left = ES_LAYOUT_LINECOUNT_WIDTH,
                 .top = 0,
-                .right = editorWidth,
-                .bottom = editorHeight};
+                .right = editorCore.width,
+                .bottom = editorCore.height};
             
             // Storage for text line counts.
-            const unsigned int visibleLines = editorHeight 
+            const sEditorState *pState = &editorCore.state;
+            const unsigned int visibleLines = editorCore.height 
                 / ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
-            const sLineNode *pNode = editorState.pActiveHead->pNode;
-            signed long jumps = editorState.pActiveHead->lineIndex
-                - editorState.firstVisibleLineIndex;
             
-            if (jumps > 0) {
-                while (jumps--) pNode = pNode->pPrev;
-                
-            } else {
-                while (jumps++) pNode = pNode->pNext;
-                
-            }
+            // Storage for the wrapped row in the rendering process.
+            const sWrapLayout *pLayout = pState->pWrapLayout;
+            unsigned long wrappedLineIndex = pState->firstVisibleLineIndex;
+            unsigned int rowStart;
+            const sLineNode *pNode = findFirstVisibleLine(&editorCore, 
+                &rowStart);
             
             // Storage for local renderer references.
             HDC hCanvas = BeginPaint(hWindow, &ps);
@@ -310,9 +338,9 @@ LRESULT editorProcedure(HWND hWindow,
             SelectObject(hCanvas, hBackgroundBrush);
             Rectangle(hCanvas, 
                 ES_LAYOUT_LINECOUNT_WIDTH, 
-                editorState.prevHighlight.top,
-                editorWidth,
-                editorState.prevHighlight.top
+                pState->prevHighlight.top,
+                editorCore.width,
+                pState->prevHighlight.top
                 + ES_LAYOUT_LINECOUNT_FONT_HEIGHT);
             
             // Render the line in focus.
@@ -320,9 +348,9 @@ LRESULT editorProcedure(HWND hWindow,
             SelectObject(hCanvas, hLineHighlightBrush);
             Rectangle(hCanvas, 
                 ES_LAYOUT_LINECOUNT_WIDTH, 
-                editorState.curHighlight.top,
-                editorWidth, 
-                editorState.curHighlight.top
+                pState->curHighlight.top,
+                editorCore.width, 
+                pState->curHighlight.top
                 + ES_LAYOUT_LINECOUNT_FONT_HEIGHT);
             
             // Render line counter text on the line counter.
@@ -330,14 +358,70 @@ LRESULT editorProcedure(HWND hWindow,
             SetTextColor(hCanvas, ES_COLOR_WHITE);
             SetBkMode(hCanvas, TRANSPARENT);
             lineCounterRect.left = 8;
+            SelectObject(hCanvas, GetStockObject(DC_BRUSH));
             for (unsigned long lineIndex = 0; lineIndex++ < visibleLines;) {
                 char lineNumberTextBuffer[21]; // Assume 64-bit int.
-                int successCode;
+                int successCode = TRUE;
+                
+                // Wrapped lines span several rows, and only their first
+                // row shows a line number.
+                if (pLayout != NULL) {
+                    if (pNode != NULL) {
+                        const char *pText = LINE_TEXT(&pNode->line);
+                        const unsigned int rowEnd = nextWrapBreak(pText, 
+                            pNode->line.characters, rowStart, 
+                            pLayout->columns);
+                        
+                        if (pState->pDiff != NULL) {
+                            paintDiffMarker(hCanvas, pState->pDiff, 
+                                wrappedLineIndex, lineCounterRect.top, 
+                                rowStart == 0);
+                            
+                        }
+                        if (rowStart == 0) {
+                            sprintf(lineNumberTextBuffer, "%lu", 
+                                wrappedLineIndex+1);
+                            successCode = DrawText(hCanvas, 
+                                lineNumberTextBuffer, -1, &lineCounterRect, 
+                                DT_SINGLELINE|DT_NOCLIP);
+                            
+                        }
+                        paintSelection(hCanvas, pState, 
+                            wrappedLineIndex, &pNode->line, rowStart, 
+                            rowEnd, codeLineRect.top);
+                        if (rowEnd > rowStart) {
+                            successCode = successCode 
+                                && DrawText(hCanvas, pText+rowStart, 
+                                rowEnd-rowStart, &codeLineRect, 
+                                DT_SINGLELINE|DT_NOCLIP|DT_NOPREFIX);
+                            
+                        }
+                        
+                        if (rowEnd >= pNode->line.characters) {
+                            pNode = pNode->pNext;
+                            ++wrappedLineIndex;
+                            rowStart = 0;
+                            
+                        } else {
+                            rowStart = rowEnd;
+                            
+                        }
+                    }
+                    if (successCode == 0) {
+                        PANIC("The renderer failed to generate text.");
+                        
+                    }
+                    
+                    lineCounterRect.top += ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
+                    codeLineRect.top += ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
+                    continue;
+                    
+                }
                 
                 // Calls to the `sprintf` function automatically 
                 // inserts a null terminator character.
                 sprintf(lineNumberTextBuffer, "%ld", 
-                    editorState.firstVisibleLineIndex+lineIndex);
+                    pState->firstVisibleLineIndex+lineIndex);
                 
                 // Draw the line counter's text line.
                 successCode = DrawText(hCanvas, lineNumberTextBuffer, -1,
@@ -345,8 +429,18 @@ LRESULT editorProcedure(HWND hWindow,
                 
                 // Draw the code line.
                 if (pNode != NULL) {
+                    if (pState->pDiff != NULL) {
+                        paintDiffMarker(hCanvas, pState->pDiff, 
+                            pState->firstVisibleLineIndex+lineIndex-1, 
+                            lineCounterRect.top, TRUE);
+                        
+                    }
+                    paintSelection(hCanvas, pState, 
+                        pState->firstVisibleLineIndex+lineIndex-1, 
+                        &pNode->line, 0, pNode->line.characters, 
+                        codeLineRect.top);
                     successCode = successCode
-                        && DrawText(hCanvas, pNode->line.pStart, 
+                        && DrawText(hCanvas, LINE_TEXT(&pNode->line), 
                         pNode->line.characters+1, &codeLineRect, 
                         DT_SINGLELINE|DT_NOCLIP|DT_NOPREFIX);
                     pNode = pNode->pNext;
@@ -374,28 +468,27 @@ LRESULT editorProcedure(HWND hWindow,
             // Update the rectangle for the window whenever the user 
             // resizes the window.
             GetWindowRect(hWindow, &currentWindowRect);
-            editorWidth = currentWindowRect.right - currentWindowRect.left;
-            editorHeight = currentWindowRect.bottom - currentWindowRect.top
-                - titlebarHeight;
+            resizeEditor(&editorCore, 
+                currentWindowRect.right - currentWindowRect.left,
+                currentWindowRect.bottom - currentWindowRect.top
+                - titlebarHeight);
             
             break;
         }
         
-        case WM_MOUSEWHEEL: {
-            
-            const signed short jumps = -GET_WHEEL_DELTA_WPARAM(wParam)
-                / ES_SCROLL_NUMBNESS;
-            const signed long update = editorState.firstVisibleLineIndex
-                + jumps;
-            
-            /*XXX: Consider multiple files later on.*/
-            if (update>=0
-                    && update<(signed long)editorState.dequeArr[0].lines) {
-                editorState.firstVisibleLineIndex = update;
+        // Take the lines that the follower read since the last frame, so
+        // that the view repaints at most once per frame.
+        case WM_TIMER: {
+            if (wParam == ES_FOLLOW_TIMER_ID) {
+                invalidateRepaint(hWindow, takeFollowedLines(&editorCore));
+                
             }
-            
-            InvalidateRect(hWindow, NULL, TRUE);
-            
+            break;
+        }
+        
+        case WM_MOUSEWHEEL: {
+            invalidateRepaint(hWindow, scrollEditor(&editorCore, 
+                GET_WHEEL_DELTA_WPARAM(wParam)));
             break;
         }
         
@@ -407,67 +500,147 @@ LRESULT editorProcedure(HWND hWindow,
     return ERROR_SUCCESS;
 }
 
-void jumpHead(sEditorState *pState, const RECT *pRefreshRectangle) {
+// Reads the modifier keys that the core takes along with an event.
+unsigned int readModifiers(void) {
     
-    sLineNode *pNode = pState->pActiveHead->pNode;
+    unsigned int modifiers = 0;
     
-    if (pState->curHighlight.relativeFocusLineIndex 
-            > pState->prevHighlight.relativeFocusLineIndex) {
-    
-        long int top = pRefreshRectangle->top;
+    if (GetKeyState(VK_CONTROL) < 0) {
+        modifiers |= ES_MODIFIER_CONTROL;
         
-        while ((top += ES_LAYOUT_LINECOUNT_FONT_HEIGHT)
-                != pRefreshRectangle->bottom && pNode->pNext != NULL) {
-            
-            pNode = pNode->pNext;
-        }
+    }
+    if (GetKeyState(VK_SHIFT) < 0) {
+        modifiers |= ES_MODIFIER_SHIFT;
         
-    } else {
+    }
+    
+    return modifiers;
+}
+
+// Invalidates the part of the view that an event changed.
+void invalidateRepaint(HWND hWindow, sRepaint repaint) {
+    
+    if (repaint.changed) {
+        InvalidateRect(hWindow, repaint.partial ? &repaint.rectangle : NULL,
+            repaint.erase);
         
-        long int bottom = pRefreshRectangle->bottom;
+    }
+    
+    return;
+}
+
+// Marks a line that differs from the file on disk in the gutter. Lines
+// that replace removed lines differ in color from added lines. Removed
+// lines mark the top of the line after them.
+void paintDiffMarker(HDC hCanvas, const sDiff *pDiff, 
+        unsigned long lineIndex, long top, int firstRow) {
+    
+    const unsigned long hunkIndex = findDiffHunk(pDiff, lineIndex);
+    const sDiffHunk *pHunk = pDiff->pHunkArr + hunkIndex;
+    long bottom = top + ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
+    COLORREF color;
+    
+    if (hunkIndex == pDiff->hunks) {
+        return;
         
-        while ((bottom -= ES_LAYOUT_LINECOUNT_FONT_HEIGHT)
-                != pRefreshRectangle->top && pNode->pPrev != NULL) {
+    }
+    
+    if (pHunk->newLines == 0) {
+        if (!firstRow || pHunk->newFirstLineIndex != lineIndex) {
+            return;
             
-            pNode = pNode->pPrev;
         }
+        color = ES_COLOR_DIFF_REMOVED;
+        bottom = top + ES_LAYOUT_DIFF_MARKER_WIDTH;
+        
+    } else if (lineIndex < pHunk->newFirstLineIndex) {
+        return;
+        
+    } else {
+        color = pHunk->oldLines == 0 ? ES_COLOR_DIFF_ADDED 
+            : ES_COLOR_DIFF_CHANGED;
         
     }
     
-    pState->pActiveHead->pNode = pNode;
+    SetDCPenColor(hCanvas, color);
+    SetDCBrushColor(hCanvas, color);
+    Rectangle(hCanvas, 
+        ES_LAYOUT_LINECOUNT_WIDTH - ES_LAYOUT_DIFF_MARKER_WIDTH, top,
+        ES_LAYOUT_LINECOUNT_WIDTH, bottom);
+    
     return;
 }
 
-RECT updateHighlight(sEditorState* pEditorState,
-        const unsigned short windowWidth,
-        const unsigned short curRelativeIndex) {
+// Fills the selected part of the characters from `rowStart` up to
+// `rowEnd` of a line. The last row of a line also shows whether the
+// selection takes the line break along.
+void paintSelection(HDC hCanvas, const sEditorState *pState, 
+        unsigned long lineIndex, const sLine *pLine, unsigned int rowStart, 
+        unsigned int rowEnd, long top) {
     
-    RECT refreshRectangle;
+    const sWriteHead *pFirst, *pLast;
+    unsigned int start = 0, end = pLine->characters + 1;
     
-    pEditorState->prevHighlight = pEditorState->curHighlight;
-    pEditorState->curHighlight.relativeFocusLineIndex = curRelativeIndex;
-    pEditorState->curHighlight.top = ES_LAYOUT_LINECOUNT_FONT_HEIGHT
-        * pEditorState->curHighlight.relativeFocusLineIndex;
+    if (!pState->selecting) {
+        return;
+        
+    }
     
-    refreshRectangle.left = ES_LAYOUT_LINECOUNT_WIDTH;
-    refreshRectangle.right = windowWidth;
-    if (pEditorState->curHighlight.top 
-            > pEditorState->prevHighlight.top) {
+    orderSelection(pState, &pFirst, &pLast);
+    if (lineIndex < pFirst->lineIndex || lineIndex > pLast->lineIndex) {
+        return;
         
-        refreshRectangle.top = pEditorState->prevHighlight.top;
-        refreshRectangle.bottom = pEditorState->curHighlight.top
-            + ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
-            
-    } else {
-        refreshRectangle.top = pEditorState->curHighlight.top;
-        refreshRectangle.bottom = pEditorState->prevHighlight.top
-            + ES_LAYOUT_LINECOUNT_FONT_HEIGHT;
+    }
+    if (lineIndex == pFirst->lineIndex) {
+        start = pFirst->characterIndex < pLine->characters 
+            ? pFirst->characterIndex : pLine->characters;
+        
+    }
+    if (lineIndex == pLast->lineIndex) {
+        end = pLast->characterIndex < pLine->characters 
+            ? pLast->characterIndex : pLine->characters;
+        
+    }
+    
+    if (rowEnd < pLine->characters && end > rowEnd) {
+        end = rowEnd;
+        
+    }
+    if (start < rowStart) {
+        start = rowStart;
+        
+    }
+    if (start >= end) {
+        return;
         
     }
     
-    // Update the index for the write head.
-    pEditorState->pActiveHead->lineIndex += curRelativeIndex
-        - pEditorState->prevHighlight.relativeFocusLineIndex;
+    SetDCPenColor(hCanvas, ES_COLOR_SELECTION);
+    SetDCBrushColor(hCanvas, ES_COLOR_SELECTION);
+    Rectangle(hCanvas, 
+        ES_LAYOUT_LINECOUNT_WIDTH 
+        + (start - rowStart) * ES_LAYOUT_LINECOUNT_FONT_WIDTH, top,
+        ES_LAYOUT_LINECOUNT_WIDTH 
+        + (end - rowStart) * ES_LAYOUT_LINECOUNT_FONT_WIDTH,
+        top + ES_LAYOUT_LINECOUNT_FONT_HEIGHT);
     
-    return refreshRectangle;
-}
\ No newline at end of file
+    return;
+}
+
+
+// Shows in the title bar how much text the document holds and how much
+// of it identical lines share.
+void showMemoryStats(HWND hWindow, const sLineDeque *pDeque) {
+    
+    const double megabyte = 1024.0*1024.0;
+    sMemoryStats stats;
+    char title[192];
+    
+    getDequeMemoryStats(pDeque, &stats);
+    sprintf(title, HEADER_NAME " - %lu lines, %.1f MB of text in %.1f MB,"
+        " %.1f MB deduplicated", stats.lines, stats.textBytes / megabyte,
+        stats.storedBytes / megabyte, stats.deduplicatedBytes / megabyte);
+    SetWindowText(hWindow, title);
+    
+    return;
+}
@@ -1,21 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "memory_manager.h"
+#include "file_indexer.h"
 
-// Lines in source code never exceed 79 characters according to 
-// the programmer's experience. Two extra characters constitute a
-// carriage return-line feed pair. However, a line necessarily ends in 
-// such a pair. As such, the line can omit these characters. However, 
-// the buffer must include these characters to properly detect them. 
-// An additional character is necessary to consider the null character.
-#define BUFFER_CHARACTERS 82
 #define TRUE 1
 #define FALSE 0
 
-#define ARRAY_CHARS(arr) (sizeof(arr)/sizeof(char))
 #define SALLOC(s) (malloc(sizeof(s)))
 
 void appendNodeToDeque(sLineNode *pNode, sLineDeque *pDeque);
+static sLineNode *constructInternedLineNode(sInternTable *pTable, 
+    const char *pText, unsigned int characters);
+static void releaseLineText(sLine *pLine);
+static void releaseTextBlock(sTextBlock *pBlock);
+static sLineDeque *constructEditorDeque(sEditorState *pEditorState, 
+    HANDLE hFile);
 
 // Debug functions
 void printDeque(sLineDeque *pDeque);
@@ -23,17 +23,16 @@ void printDeque(sLineDeque *pDeque);
 enum EsError loadFileIntoEditorState(const char *pFilepath, 
         sEditorState *pEditorState) {
     
-    char buffer[BUFFER_CHARACTERS] = { 0 };     // Buffer for file.
-    sLine dynamicBuffer;                        // Persistent buffer.
     sLineDeque *pDeque;                         // Line deque of file.
     HANDLE hFile;                               // Handle to file.
-    unsigned long int outputCharacters;         // Characters to read.
-    unsigned long int files = 0;                // Open file amount.
+    enum EsError result;                        // Indexing outcome.
     
     // Remember to call the `CloseHandle` function to close the file.
+    // Other processes may keep appending to the file, which the follow
+    // mode reads.
     hFile = CreateFile(pFilepath, 
         GENERIC_READ|GENERIC_WRITE,
-        0, /*Does not allow file sharing.*/
+        FILE_SHARE_READ|FILE_SHARE_WRITE,
         NULL, /*Do not adorn with auxiliary descriptors.*/
         OPEN_EXISTING,
         FILE_ATTRIBUTE_NORMAL,
@@ -44,169 +43,436 @@ enum EsError loadFileIntoEditorState(const char *pFilepath,
         
     }
     
+    pDeque = constructEditorDeque(pEditorState, hFile);
+    if (pDeque == NULL) {
+        CloseHandle(hFile);
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    // Index the lines of the file across all processors.
+    result = indexFileIntoDeque(hFile, pDeque, pEditorState->internLines);
+    if (result != ES_ERROR_SUCCESS) {
+        return result;
+        
+    }
+    
+    // Set the head node of the deque as the initial line subject to
+    // edits.
+    pDeque->writeHead.pNode = pDeque->pHead;
+    pDeque->writeHead.characterIndex = 0;
+    pDeque->writeHead.lineIndex = 0;
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Opens a document without a file, which holds a single empty line.
+// Text from a pipe can then stream into it.
+enum EsError loadEmptyIntoEditorState(sEditorState *pEditorState) {
+    
+    sLineDeque *pDeque = constructEditorDeque(pEditorState, 
+        INVALID_HANDLE_VALUE);
+    sLineNode *pNode;
+    
+    if (pDeque == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    pNode = constructLineNode(0);
+    if (pNode == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    appendNodeToDeque(pNode, pDeque);
+    
+    pDeque->writeHead.pNode = pNode;
+    pDeque->writeHead.characterIndex = 0;
+    pDeque->writeHead.lineIndex = 0;
+    
+    return ES_ERROR_SUCCESS;
+}
+
+static sLineDeque *constructEditorDeque(sEditorState *pEditorState, 
+        HANDLE hFile) {
+    
+    sLineDeque *pDeque;
+    
     /*XXX: Consider the case that a file is already open.*/
     // Add a deque.
     pEditorState->dequeArr = SALLOC(sLineDeque);
+    if (pEditorState->dequeArr == NULL) {
+        return NULL;
+        
+    }
     
     // Initialize the deque specific to the open file.
     pDeque = pEditorState->dequeArr;
     pDeque->lines = 0;
+    pDeque->loadedBytes = 0;
+    pDeque->tailBytes = 0;
     pDeque->hFile = hFile;
     pDeque->pTail = pDeque->pHead = NULL;
+    pDeque->pUndoHistory = NULL;
+    
+    return pDeque;
+}
+
+// Splits bytes into lines that end in line feed characters. A carriage
+// return before the line feed is not part of the line. The bytes
+// after the last line feed only form a line when no more bytes follow,
+// which the `final` flag indicates. Otherwise, the consumed byte count
+// excludes them so that the caller can prepend them to the next bytes.
+// Lines share their text through the intern table when there is one.
+enum EsError splitLinesIntoChain(const char *pBytes, size_t bytes, 
+        int final, sInternTable *pTable, sLineChain *pChain, 
+        size_t *pConsumed) {
+    
+    size_t lineStart = 0;
     
-    // Prepare the buffer that stores file contents across iterations
-    // searching for carriage return characters.
-    dynamicBuffer.characters = 0;
-    dynamicBuffer.pStart = malloc(1*sizeof(char));
-    dynamicBuffer.pStart[0] = '\0';
-    
-    // Read lines from the open file.
-    do {
-        unsigned int characterIndex, beginningIndex, lineCharacters;
-        
-        if (!ReadFile(hFile, buffer, 
-                ARRAY_CHARS(buffer)-1 /*Ignore null terminator*/, 
-                &outputCharacters, 
-                NULL)) {
-            return ES_ERROR_PARSING_ERROR;
+    *pConsumed = 0;
+    for (;;) {
+        const char *pFeed = memchr(pBytes+lineStart, '\n', 
+            bytes-lineStart);
+        size_t lineEnd = pFeed == NULL ? bytes : (size_t) (pFeed-pBytes);
+        size_t characters = lineEnd - lineStart;
+        sLineNode *pNode;
+        
+        if (pFeed == NULL && !final) {
+            break;
             
         }
         
-        // The CR+LF may be across two subsequent iterations. 
-        // It is important to skip the line feed character in this 
-        // case.
-        characterIndex = beginningIndex = buffer[0] == '\n';
-        do {
-            sLineNode *pNode;
-            
-            for (lineCharacters = 0; 
-                    buffer[characterIndex] != '\r'
-                    && characterIndex < outputCharacters;
-                    ++characterIndex, ++lineCharacters);
+        if (characters > 0 && pBytes[lineEnd-1] == '\r') {
+            --characters;
             
-            if (characterIndex >= outputCharacters) {
-                unsigned int biggerStrCharacters = dynamicBuffer.characters 
-                    + lineCharacters;
-                unsigned int remainerSegmentIndex = ARRAY_CHARS(buffer) 
-                    - lineCharacters - 1;
-                
-                // The function reached the end of the buffer without
-                // seeing any carriage return.
-                
-                dynamicBuffer.pStart = realloc(dynamicBuffer.pStart, 
-                    sizeof(char)*(biggerStrCharacters + 1 /*Null*/));
-                if (dynamicBuffer.pStart == NULL) {
-                    return ES_ERROR_ALLOCATION_FAIL;
-                    
-                }
-                
-                memcpy(dynamicBuffer.pStart+dynamicBuffer.characters, 
-                    buffer+remainerSegmentIndex, lineCharacters);
-                
-                // Read another chunk of data from the input file if 
-                // not the last line.
-                if (outputCharacters == ARRAY_CHARS(buffer)
-                        - 1 /*Ignore null terminator.*/) {
-                    
-                    // Only update the number of characters when not 
-                    // at the last line. There are no more characters 
-                    // to expect after the last line.
-                    dynamicBuffer.characters = biggerStrCharacters;
-                    break;
-                    
-                }
-                
-                // Otherwise, no more characters are present.
-                
-            }
+        }
+        
+        // Short lines gain nothing from sharing their text.
+        if (pTable != NULL && characters >= ES_LINE_SHARED_CHARACTERS) {
+            pNode = constructInternedLineNode(pTable, pBytes+lineStart, 
+                characters);
             
-            // Otherwise, the parser found a carriage return character.
-            // The dynamic buffer can remain at its last size.
-            // However, the parsing process must decide from which 
-            // buffer to read data from. A dynamic buffer size of zero
-            // can hint to not read from it.
-            if (dynamicBuffer.characters == 0) {
-                
-                pNode = constructLineNode(lineCharacters);
-                
-                // Initialize the line that the node points to.
-                memcpy(pNode->line.pStart, 
-                    buffer+beginningIndex /*Start at the substring*/, 
-                    sizeof(char)*lineCharacters);
-                
-            } else {
-                // A line exceeding the capacity of the buffer 
-                // requires a special initialization procedure.
-                
-                pNode = constructLineNode(dynamicBuffer.characters
-                    + lineCharacters /*Plus the buffer's line.*/);
-                
-                memcpy(pNode->line.pStart,
-                    dynamicBuffer.pStart,
-                    sizeof(char)*dynamicBuffer.characters);                
-                memcpy(pNode->line.pStart+dynamicBuffer.characters,
-                    buffer,
-                    sizeof(char)*lineCharacters);
-                
-                // Hint for the next iteration to not read from the
-                // dynamic buffer.
-                dynamicBuffer.characters = 0;
+        } else {
+            pNode = constructLineNode(characters);
+            if (pNode != NULL) {
+                memcpy(LINE_TEXT(&pNode->line), pBytes+lineStart, 
+                    sizeof(char)*characters);
                 
             }
+        }
+        if (pNode == NULL) {
+            return ES_ERROR_ALLOCATION_FAIL;
             
-            // Append the node to the line deque.
-            appendNodeToDeque(pNode, pDeque);
+        }
+        appendNodeToChain(pNode, pChain);
+        
+        if (pFeed == NULL) {
+            lineStart = bytes;
+            break;
             
-            // Prepare the index in the buffer delimiting the start of 
-            // the next line. This index is only useful for reading 
-            // next lines when the buffer has information. Two 
-            // additional characters are necessary to consider the 
-            // carriage return and line feed.
-            beginningIndex += lineCharacters+2;
-            characterIndex += 2; /*Skip the CR+LF*/
-        } while (characterIndex < outputCharacters);
-    } while (outputCharacters != 0);
-    
-    free(dynamicBuffer.pStart);
-    
-    // Set the head node of the deque as the initial line subject to
-    // edits.
-    pDeque->writeHead.pNode = pDeque->pHead;
-    pDeque->writeHead.characterIndex = 0;
-    pDeque->writeHead.lineIndex = 0;
+        }
+        lineStart = lineEnd + 1 /*Skip the line feed*/;
+    }
     
+    *pConsumed = lineStart;
     return ES_ERROR_SUCCESS;
 }
 
 sLineNode *constructLineNode(unsigned int characters) {
     
-    // Allocate memory for node
-    sLineNode *pNode = SALLOC(sLineNode);
+    // Allocate memory for node and the null-terminating string after
+    // it.
+    sLineNode *pNode = malloc(sizeof(sLineNode) 
+        + sizeof(char)*(characters+1/*Null sentinel*/));
     if (pNode == NULL) {
         return NULL;
         
     }
     
-    // Allocate memory for null-terminating string.
-    pNode->line.pStart = malloc(sizeof(char)*(characters+1/*Null sentinel*/));
-    if (pNode->line.pStart == NULL) {
-        return NULL;
-        
-    }
     pNode->line.characters = characters;
+    pNode->line.shared = FALSE;
+    pNode->line.pStart = pNode->text;
     
     // Add null-terminating character.
-    pNode->line.pStart[characters] = '\0';
+    pNode->text[characters] = '\0';
     
     return pNode;
 }
 
 void destructLineNode(sLineNode *pNode) {
-    free(pNode->line.pStart);
+    releaseLineText(&pNode->line);
     free(pNode);
     return;
 }
 
+// Makes a node with the text of another one. Long text is never
+// copied: text that the source keeps after its node moves into a text
+// block, which both lines share afterwards. Lines never change in
+// place, since edits rebuild them, so shared text stays as it is.
+sLineNode *constructSharedLineNode(sLineNode *pSource) {
+    
+    sLine *pLine = &pSource->line;
+    const unsigned int characters = pLine->characters;
+    sLineNode *pNode;
+    
+    if (!pLine->shared && characters < ES_LINE_SHARED_CHARACTERS) {
+        pNode = constructLineNode(characters);
+        if (pNode != NULL) {
+            memcpy(pNode->text, pLine->pStart, sizeof(char)*characters);
+            
+        }
+        return pNode;
+        
+    }
+    
+    pNode = SALLOC(sLineNode);
+    if (pNode == NULL) {
+        return NULL;
+        
+    }
+    
+    if (!pLine->shared) {
+        sTextBlock *pBlock = malloc(sizeof(sTextBlock) 
+            + sizeof(char)*(characters+1/*Null sentinel*/));
+        
+        if (pBlock == NULL) {
+            free(pNode);
+            return NULL;
+            
+        }
+        
+        // Blocks carry the hash of their text, which the diff reuses.
+        // The text after the source node stays unused until the node
+        // goes.
+        pBlock->references = 1;
+        pBlock->characters = characters;
+        pBlock->pNextInBucket = NULL;
+        memcpy(pBlock->text, pLine->pStart, sizeof(char)*(characters+1));
+        pBlock->hash = hashLineText(pBlock->text, characters);
+        
+        pLine->shared = TRUE;
+        pLine->pStart = pBlock->text;
+        
+    }
+    
+    InterlockedIncrement(&LINE_BLOCK(pLine)->references);
+    pNode->line = *pLine;
+    
+    return pNode;
+}
+
+// Constructs a line out of up to three pieces of text, such as the
+// text before a splice, the text that it inserts and the text after it.
+sLineNode *constructJoinedLineNode(const char *pBefore, 
+        unsigned int beforeCharacters, const char *pMiddle, 
+        unsigned int middleCharacters, const char *pAfter, 
+        unsigned int afterCharacters) {
+    
+    sLineNode *pNode = constructLineNode(beforeCharacters 
+        + middleCharacters + afterCharacters);
+    char *pText;
+    
+    if (pNode == NULL) {
+        return NULL;
+        
+    }
+    pText = LINE_TEXT(&pNode->line);
+    memcpy(pText, pBefore, sizeof(char)*beforeCharacters);
+    memcpy(pText+beforeCharacters, pMiddle, 
+        sizeof(char)*middleCharacters);
+    memcpy(pText+beforeCharacters+middleCharacters, pAfter,
+        sizeof(char)*afterCharacters);
+    
+    return pNode;
+}
+
+enum EsError constructInternTable(sInternTable *pTable, 
+        unsigned long expectedLines) {
+    
+    unsigned long stripeIndex;
+    
+    // Keep the bucket count a power of two to mask hashes into it.
+    pTable->buckets = ES_INTERN_STRIPES;
+    while (pTable->buckets < expectedLines 
+            && pTable->buckets < (1UL << 24)) {
+        pTable->buckets <<= 1;
+    }
+    
+    pTable->pBucketArr = calloc(pTable->buckets, sizeof(sTextBlock *));
+    pTable->pSeenArr = calloc(pTable->buckets, sizeof(unsigned char));
+    if (pTable->pBucketArr == NULL || pTable->pSeenArr == NULL) {
+        free(pTable->pBucketArr);
+        free(pTable->pSeenArr);
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    for (stripeIndex = 0; stripeIndex < ES_INTERN_STRIPES; 
+            ++stripeIndex) {
+        InitializeCriticalSection(pTable->stripeArr+stripeIndex);
+    }
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Frees the table but not the text blocks, which belong to the lines.
+void destructInternTable(sInternTable *pTable) {
+    
+    unsigned long stripeIndex;
+    
+    for (stripeIndex = 0; stripeIndex < ES_INTERN_STRIPES; 
+            ++stripeIndex) {
+        DeleteCriticalSection(pTable->stripeArr+stripeIndex);
+    }
+    free(pTable->pBucketArr);
+    free(pTable->pSeenArr);
+    pTable->pBucketArr = NULL;
+    pTable->pSeenArr = NULL;
+    
+    return;
+}
+
+// Adds up the bytes of line text. A line that shares its text with 
+// other lines only accounts for its share of the text block.
+void getDequeMemoryStats(const sLineDeque *pDeque, sMemoryStats *pStats) {
+    
+    const sLineNode *pNode;
+    double storedBytes = 0.0;
+    
+    pStats->lines = 0;
+    pStats->textBytes = 0;
+    for (pNode = pDeque->pHead; pNode != NULL; pNode = pNode->pNext) {
+        const unsigned int bytes = pNode->line.characters+1;
+        
+        ++(pStats->lines);
+        pStats->textBytes += bytes;
+        if (pNode->line.shared) {
+            storedBytes += (double) bytes 
+                / LINE_BLOCK(&pNode->line)->references;
+            
+        } else {
+            storedBytes += bytes;
+            
+        }
+    }
+    
+    pStats->storedBytes = (unsigned long long) (storedBytes + 0.5);
+    pStats->deduplicatedBytes = pStats->textBytes > pStats->storedBytes 
+        ? pStats->textBytes - pStats->storedBytes : 0;
+    
+    return;
+}
+
+// Hashes the text of a line with 32-bit FNV-1a.
+unsigned long hashLineText(const char *pText, unsigned int characters) {
+    
+    unsigned long hash = 2166136261UL;  // FNV-1a offset basis.
+    unsigned int characterIndex;
+    
+    for (characterIndex = 0; characterIndex < characters; 
+            ++characterIndex) {
+        hash = ((hash ^ (unsigned char) pText[characterIndex]) 
+            * 16777619UL) & 0xFFFFFFFFUL;
+    }
+    
+    return hash;
+}
+
+// Makes a node for a line of a file that interns its lines. Text seen
+// for the first time stays after its node, since most lines never
+// repeat. Once the text repeats, its lines share a text block. Each
+// bucket keeps a byte of bits that hashes set when their text stays
+// unshared. A bit that another text set only makes that line share.
+static sLineNode *constructInternedLineNode(sInternTable *pTable, 
+        const char *pText, unsigned int characters) {
+    
+    sLineNode *pNode;
+    sTextBlock *pBlock;
+    const unsigned long hash = hashLineText(pText, characters);
+    const unsigned char seenBit = (unsigned char) (1 << ((hash >> 24) & 7));
+    unsigned long bucketIndex;
+    CRITICAL_SECTION *pStripe;
+    
+    bucketIndex = hash & (pTable->buckets-1);
+    pStripe = pTable->stripeArr + (bucketIndex % ES_INTERN_STRIPES);
+    
+    EnterCriticalSection(pStripe);
+    for (pBlock = pTable->pBucketArr[bucketIndex]; pBlock != NULL; 
+            pBlock = pBlock->pNextInBucket) {
+        if (pBlock->hash == hash && pBlock->characters == characters
+                && memcmp(pBlock->text, pText, characters) == 0) {
+            InterlockedIncrement(&pBlock->references);
+            break;
+            
+        }
+    }
+    
+    if (pBlock == NULL && !(pTable->pSeenArr[bucketIndex] & seenBit)) {
+        pTable->pSeenArr[bucketIndex] |= seenBit;
+        LeaveCriticalSection(pStripe);
+        
+        pNode = constructLineNode(characters);
+        if (pNode != NULL) {
+            memcpy(pNode->text, pText, sizeof(char)*characters);
+            
+        }
+        return pNode;
+        
+    }
+    
+    if (pBlock == NULL) {
+        pBlock = malloc(sizeof(sTextBlock) 
+            + sizeof(char)*(characters+1/*Null sentinel*/));
+        if (pBlock == NULL) {
+            LeaveCriticalSection(pStripe);
+            return NULL;
+            
+        }
+        
+        pBlock->references = 1;
+        pBlock->characters = characters;
+        pBlock->hash = hash;
+        memcpy(pBlock->text, pText, sizeof(char)*characters);
+        pBlock->text[characters] = '\0';
+        
+        pBlock->pNextInBucket = pTable->pBucketArr[bucketIndex];
+        pTable->pBucketArr[bucketIndex] = pBlock;
+        
+    }
+    LeaveCriticalSection(pStripe);
+    
+    // The node holds no text, so a failure only gives up the share.
+    pNode = SALLOC(sLineNode);
+    if (pNode == NULL) {
+        releaseTextBlock(pBlock);
+        return NULL;
+        
+    }
+    pNode->line.characters = characters;
+    pNode->line.shared = TRUE;
+    pNode->line.pStart = pBlock->text;
+    
+    return pNode;
+}
+
+// Gives up a share of a text block. Other text goes with its node.
+static void releaseLineText(sLine *pLine) {
+    if (pLine->shared) {
+        releaseTextBlock(LINE_BLOCK(pLine));
+        
+    }
+    return;
+}
+
+static void releaseTextBlock(sTextBlock *pBlock) {
+    if (InterlockedDecrement(&pBlock->references) == 0) {
+        free(pBlock);
+        
+    }
+    return;
+}
+
 void appendNodeToDeque(sLineNode *pAddition, sLineDeque *pDeque) {
     sLineNode *pPenultimate = pDeque->pTail;
     
@@ -228,11 +494,147 @@ void appendNodeToDeque(sLineNode *pAddition, sLineDeque *pDeque) {
     return;
 }
 
+void appendNodeToChain(sLineNode *pAddition, sLineChain *pChain) {
+    
+    pAddition->pPrev = pChain->pTail;
+    pAddition->pNext = NULL;
+    
+    if (pChain->pTail == NULL) {
+        pChain->pHead = pAddition;
+        
+    } else {
+        pChain->pTail->pNext = pAddition;
+        
+    }
+    
+    pChain->pTail = pAddition;
+    ++(pChain->lines);
+    
+    return;
+}
+
+// Moves every node of the chain to the end of the deque. The chain is
+// empty afterwards.
+void appendChainToDeque(sLineChain *pChain, sLineDeque *pDeque) {
+    
+    if (pChain->pHead == NULL) {
+        return;
+        
+    }
+    
+    pChain->pHead->pPrev = pDeque->pTail;
+    if (pDeque->pTail == NULL) {
+        pDeque->pHead = pChain->pHead;
+        
+    } else {
+        pDeque->pTail->pNext = pChain->pHead;
+        
+    }
+    
+    pDeque->pTail = pChain->pTail;
+    pDeque->lines += pChain->lines;
+    
+    pChain->pHead = pChain->pTail = NULL;
+    pChain->lines = 0;
+    
+    return;
+}
+
+void destructLineChain(sLineChain *pChain) {
+    while (pChain->pHead != NULL) {
+        sLineNode *pNext = pChain->pHead->pNext;
+        destructLineNode(pChain->pHead);
+        pChain->pHead = pNext;
+    }
+    pChain->pTail = NULL;
+    pChain->lines = 0;
+    return;
+}
+
+// Constructs an empty clip with a single reference, which belongs to
+// the caller.
+sClip *constructClip(void) {
+    
+    sClip *pClip = SALLOC(sClip);
+    
+    if (pClip == NULL) {
+        return NULL;
+        
+    }
+    pClip->references = 1;
+    pClip->lines.pHead = pClip->lines.pTail = NULL;
+    pClip->lines.lines = 0;
+    pClip->spare.pHead = pClip->spare.pTail = NULL;
+    pClip->spare.lines = 0;
+    pClip->pNextSpare = NULL;
+    
+    return pClip;
+}
+
+void releaseClip(sClip *pClip) {
+    if (pClip != NULL && InterlockedDecrement(&pClip->references) == 0) {
+        destructLineChain(&pClip->spare);
+        destructLineChain(&pClip->lines);
+        free(pClip);
+        
+    }
+    return;
+}
+
+// Finds the inner line that the next spare copies, which is the last
+// line once every inner line has a spare. Clips without inner lines
+// have nothing to copy and return NULL.
+sLineNode *findNextSpareSource(const sClip *pClip) {
+    
+    if (pClip->lines.lines < 3) {
+        return NULL;
+        
+    }
+    
+    return pClip->pNextSpare != NULL 
+        ? pClip->pNextSpare : pClip->lines.pHead->pNext;
+}
+
+// Frees the spares, so that the next copy starts over.
+void discardClipSpare(sClip *pClip) {
+    destructLineChain(&pClip->spare);
+    pClip->pNextSpare = NULL;
+    return;
+}
+
+// Copies a step of the inner lines of a clip into its spares. Returns
+// zero once every inner line has a spare, or when memory runs out, in
+// which case a paste copies the rest itself.
+int stepClipSpare(void *pContext) {
+    
+    sClip *pClip = pContext;
+    sLineNode *pSource = findNextSpareSource(pClip);
+    unsigned long steps;
+    
+    if (pSource == NULL) {
+        return FALSE;
+        
+    }
+    for (steps = 0; steps < ES_CLIP_SPARE_STEP_LINES 
+            && pSource != pClip->lines.pTail; ++steps) {
+        sLineNode *pSpare = constructSharedLineNode(pSource);
+        
+        if (pSpare == NULL) {
+            return FALSE;
+            
+        }
+        appendNodeToChain(pSpare, &pClip->spare);
+        pSource = pSource->pNext;
+        pClip->pNextSpare = pSource;
+    }
+    
+    return pSource != pClip->lines.pTail;
+}
 
 void printDeque(sLineDeque *pDeque) {
     sLineNode *pNode = pDeque->pHead;
     while (pNode != NULL) {
-        printf("%s\n", pNode->line.pStart);
+        printf("%s\n", LINE_TEXT(&pNode->line));
         pNode = pNode->pNext;
     }
     puts("X");
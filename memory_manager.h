@@ -1,29 +1,124 @@
+#include <stddef.h>
 #include "global_data.h"
 
 #ifndef _HEADER_MEMORY_MANAGER
 
+// Buckets of the intern table that share a lock.
+#define ES_INTERN_STRIPES 256
+
+// Immutable text that identical lines share. The last line to release
+// the block frees it.
+typedef struct TextBlock {
+    LONG volatile references;
+    unsigned int characters;
+    unsigned long hash;
+    struct TextBlock *pNextInBucket;
+    char text[];
+} sTextBlock;
+
+// Lines shorter than this keep a copy of their text rather than share
+// a text block, which would save too little to pay for its header.
+#define ES_LINE_SHARED_CHARACTERS 24
+
+// A line either points into a text block that it shares with identical
+// lines or to the text that follows its node.
 typedef struct {
-    char *pStart;
     unsigned int characters;
+    unsigned int shared;                // Text lies in a text block.
+    char *pStart;
 } sLine;
 
+#define LINE_TEXT(pLine) ((pLine)->pStart)
+#define LINE_BLOCK(pLine) ((sTextBlock *) \
+    ((pLine)->pStart - offsetof(sTextBlock, text)))
+
+// Nodes vary in size. A line that shares no text keeps it right after
+// the links, so that painting it touches a single allocation.
 typedef struct LineNode {
     struct LineNode *pPrev;
     struct LineNode *pNext;
     sLine line;
+    char text[];
 } sLineNode;
 
+// A chain of linked nodes that does not belong to a deque yet.
+typedef struct {
+    sLineNode *pHead;
+    sLineNode *pTail;
+    unsigned long lines;
+} sLineChain;
+
+// Inner lines of a clip that a step of its background copy takes.
+#define ES_CLIP_SPARE_STEP_LINES 1024
+
+// Lines that the clipboard or the undo history holds. The lines of a
+// clip never change, so several owners share it, and its long lines
+// share their text blocks with the lines they came from. The last
+// owner to release the clip frees it.
+// A clip also keeps spare copies of its inner lines, which are all
+// but the first and the last one. A background task copies them ahead
+// of a paste, which then moves the spares into the deque and copies
+// only the lines that the task did not reach.
+typedef struct Clip {
+    LONG volatile references;
+    sLineChain lines;                   // At least one line.
+    sLineChain spare;                   // Copies of the first inner lines.
+    sLineNode *pNextSpare;              // Next inner line to copy.
+} sClip;
+
+// Hash table that finds the text block of identical lines while
+// several threads load a file.
+typedef struct {
+    sTextBlock **pBucketArr;
+    unsigned char *pSeenArr;            // Bits of the text seen once.
+    unsigned long buckets;
+    CRITICAL_SECTION stripeArr[ES_INTERN_STRIPES];
+} sInternTable;
+
+typedef struct {
+    unsigned long lines;
+    unsigned long long textBytes;       // Bytes that lines display.
+    unsigned long long storedBytes;     // Bytes that lines occupy.
+    unsigned long long deduplicatedBytes;
+} sMemoryStats;
+
 typedef struct LineDeque {
     unsigned long lines;
+    unsigned long long loadedBytes;
+    unsigned int tailBytes;             // Source bytes of the last line.
     HANDLE hFile;
     sLineNode *pHead;
     sLineNode *pTail;
     sWriteHead writeHead;
+    struct UndoEntry *pUndoHistory;
 } sLineDeque;
 
 enum EsError loadFileIntoEditorState(const char *pFilepath, 
     sEditorState *pEditorState);
+enum EsError loadEmptyIntoEditorState(sEditorState *pEditorState);
 sLineNode *constructLineNode(unsigned int characters);
+void destructLineNode(sLineNode *pNode);
+enum EsError splitLinesIntoChain(const char *pBytes, size_t bytes, 
+    int final, sInternTable *pTable, sLineChain *pChain, 
+    size_t *pConsumed);
+sLineNode *constructSharedLineNode(sLineNode *pSource);
+sLineNode *constructJoinedLineNode(const char *pBefore, 
+    unsigned int beforeCharacters, const char *pMiddle, 
+    unsigned int middleCharacters, const char *pAfter, 
+    unsigned int afterCharacters);
+void appendNodeToChain(sLineNode *pNode, sLineChain *pChain);
+void appendChainToDeque(sLineChain *pChain, sLineDeque *pDeque);
+void destructLineChain(sLineChain *pChain);
+sClip *constructClip(void);
+void releaseClip(sClip *pClip);
+sLineNode *findNextSpareSource(const sClip *pClip);
+void discardClipSpare(sClip *pClip);
+int stepClipSpare(void *pContext);
+enum EsError constructInternTable(sInternTable *pTable, 
+    unsigned long expectedLines);
+void destructInternTable(sInternTable *pTable);
+unsigned long hashLineText(const char *pText, unsigned int characters);
+void getDequeMemoryStats(const sLineDeque *pDeque, sMemoryStats *pStats);
 
 #define _HEADER_MEMORY_MANAGER
 #endif
@@ -0,0 +1,1167 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sort_manager.h"
+
+#define SALLOC(s) (malloc(sizeof(s)))
+
+// A line with eight bytes of its text in an integer that compares
+// like them, which spares most comparisons a visit to the node. The
+// bytes start at a depth into the line. Characters that remain from
+// that depth on tell lines apart that end within the prefix. Counts
+// beyond the prefix all look alike.
+typedef struct {
+    unsigned long long prefix;
+    sLineNode *pNode;
+    unsigned long lineIndex;        // Index before the sort.
+    unsigned int restCharacters;
+} sSortKey;
+
+#define ES_SORT_PREFIX_CHARACTERS 8
+
+// Keys that one thread sorts in place, or two adjacent sorted ranges
+// of keys that one thread merges into the target.
+typedef struct {
+    int merging;
+    sSortKey *pSource;
+    sSortKey *pTarget;              // Scratch space of a sort.
+    unsigned long firstIndex;
+    unsigned long middleIndex;      // Start of the second range.
+    unsigned long lastIndex;        // Exclusive.
+} sSortSlice;
+
+// A temporary file behind a buffer, which either writes or reads. A
+// line in a run starts with its character count and its node.
+typedef struct {
+    HANDLE hFile;
+    char *pBuffer;
+    size_t capacity;
+    size_t start;                   // First byte the reader did not take.
+    size_t bytes;                   // Bytes in the buffer.
+    const char *pText;              // Line the reader took last.
+    unsigned int characters;
+    sLineNode *pSource;             // Node of that line.
+    int failed;
+} sSpillFile;
+
+static enum EsError sortInMemory(sLineDeque *pDeque, int unique,
+    sUndoEntry *pEntry);
+static enum EsError sortExternally(sLineDeque *pDeque, int unique,
+    sUndoEntry *pEntry);
+static enum EsError mergeRuns(sSpillFile *pRunArr, unsigned long runs,
+    int unique, sLineChain *pChain);
+static void siftRunDown(const sSpillFile *pRunArr, unsigned long *pHeapArr,
+    unsigned long heapSize, unsigned long heapIndex);
+static int isRunBefore(const sSpillFile *pRunArr, unsigned long runA,
+    unsigned long runB);
+static sSortKey *sortKeys(sSortKey *pKeys, sSortKey *pScratch,
+    unsigned long keys);
+static void runSlices(sSortSlice *pSliceArr, unsigned long slices);
+static DWORD WINAPI sortSlice(LPVOID pParameter);
+static void sortKeyRange(sSortKey *pKeys, sSortKey *pScratch,
+    unsigned long keys, unsigned int depth);
+static void radixSortKeys(sSortKey *pKeys, sSortKey *pScratch,
+    unsigned long keys);
+static void insertionSortKeys(sSortKey *pKeys, unsigned long keys);
+static void fillSortKey(sSortKey *pKey, sLineNode *pNode,
+    unsigned long lineIndex);
+static void readKeyPrefix(sSortKey *pKey, unsigned int depth);
+static int compareKeyPrefixes(const void *pA, const void *pB);
+static int compareSortKeys(const void *pA, const void *pB);
+static int compareKeyTexts(const sSortKey *pA, const sSortKey *pB);
+static int compareLineTexts(const char *pA, unsigned int charactersA,
+    const char *pB, unsigned int charactersB);
+static int dropsLine(const sLine *pLine, const char *pPattern,
+    unsigned int patternCharacters, int keepMatches);
+static void damageWholeDeque(sLineDeque *pDeque,
+    unsigned long previousLines, sDamage *pDamage);
+static sUndoEntry *constructUndoEntry(enum EsUndoKind kind,
+    unsigned long lines);
+static HANDLE createTemporaryFile(void);
+static int openSpillFile(sSpillFile *pFile);
+static void closeSpillFile(sSpillFile *pFile);
+static int writeSpillFile(sSpillFile *pFile, const void *pBytes,
+    size_t bytes);
+static int flushSpillFile(sSpillFile *pFile);
+static int fillSpillFile(sSpillFile *pFile, size_t bytes);
+static int readSpilledLine(sSpillFile *pFile);
+
+// Sorts the lines by their bytes. Lines with equal text keep their
+// order, and dropping duplicates keeps the first of them. While the
+// keys of all lines fit the memory budget, the sort only relinks the
+// nodes. Larger documents sort in runs on disk, and a merge of the
+// runs rebuilds their lines. A single undo step reverts either. A
+// failed sort leaves the document as it was.
+enum EsError sortDequeLines(sLineDeque *pDeque, int unique,
+        sDamage *pDamage) {
+    
+    const unsigned long previousLines = pDeque->lines;
+    sUndoEntry *pEntry;
+    enum EsError result;
+    
+    pDamage->firstLineIndex = pDamage->lastLineIndex = 0;
+    pDamage->lineDelta = 0;
+    if (previousLines < 2) {
+        return ES_ERROR_SUCCESS;
+        
+    }
+    
+    if (previousLines <= ES_SORT_MEMORY_BYTES / (2*sizeof(sSortKey))) {
+        pEntry = constructUndoEntry(ES_UNDO_ORDER, previousLines);
+        result = pEntry == NULL ? ES_ERROR_ALLOCATION_FAIL
+            : sortInMemory(pDeque, unique, pEntry);
+        
+    } else {
+        pEntry = constructUndoEntry(ES_UNDO_SNAPSHOT, previousLines);
+        result = pEntry == NULL ? ES_ERROR_ALLOCATION_FAIL
+            : sortExternally(pDeque, unique, pEntry);
+        
+    }
+    if (result != ES_ERROR_SUCCESS) {
+        free(pEntry);
+        return result;
+        
+    }
+    
+    pushUndoEntry(pDeque, pEntry);
+    damageWholeDeque(pDeque, previousLines, pDamage);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Keeps the lines that contain the pattern, or drops them. The undo
+// step holds on to the nodes of the dropped lines. A document keeps at
+// least one line, so a filter that would drop every line fails.
+enum EsError filterDequeLines(sLineDeque *pDeque, const char *pPattern,
+        unsigned int patternCharacters, int keepMatches, sDamage *pDamage) {
+    
+    const unsigned long previousLines = pDeque->lines;
+    sUndoEntry *pEntry;
+    sLineNode *pNode;
+    sLineChain kept = { 0 };
+    unsigned long lineIndex = 0, removedLines = 0, removedIndex = 0;
+    
+    pDamage->firstLineIndex = pDamage->lastLineIndex = 0;
+    pDamage->lineDelta = 0;
+    
+    // Patterns never match across lines.
+    if (patternCharacters == 0
+            || memchr(pPattern, '\n', patternCharacters) != NULL) {
+        return ES_ERROR_INVALID_EDIT;
+        
+    }
+    
+    // Count the dropped lines first, so that a failed allocation leaves
+    // the deque as it is.
+    for (pNode = pDeque->pHead; pNode != NULL; pNode = pNode->pNext) {
+        if (dropsLine(&pNode->line, pPattern, patternCharacters,
+                keepMatches)) {
+            ++removedLines;
+            
+        }
+    }
+    if (removedLines == 0) {
+        return ES_ERROR_SUCCESS;
+        
+    }
+    if (removedLines == previousLines) {
+        return ES_ERROR_INVALID_EDIT;
+        
+    }
+    
+    pEntry = constructUndoEntry(ES_UNDO_ORDER, previousLines);
+    if (pEntry == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    pEntry->pRemovedIndexArr = malloc(sizeof(unsigned long)*removedLines);
+    if (pEntry->pRemovedIndexArr == NULL) {
+        free(pEntry);
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    pNode = pDeque->pHead;
+    while (pNode != NULL) {
+        sLineNode *pNext = pNode->pNext;
+        
+        if (dropsLine(&pNode->line, pPattern, patternCharacters,
+                keepMatches)) {
+            appendNodeToChain(pNode, &pEntry->removed);
+            pEntry->pRemovedIndexArr[removedIndex++] = lineIndex;
+            
+        } else {
+            appendNodeToChain(pNode, &kept);
+            
+        }
+        pNode = pNext;
+        ++lineIndex;
+    }
+    
+    pDeque->pHead = pDeque->pTail = NULL;
+    pDeque->lines = 0;
+    appendChainToDeque(&kept, pDeque);
+    
+    pushUndoEntry(pDeque, pEntry);
+    damageWholeDeque(pDeque, previousLines, pDamage);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Sorts the keys of all lines at once and relinks the nodes in their
+// order. The undo step keeps the earlier index of every line.
+static enum EsError sortInMemory(sLineDeque *pDeque, int unique,
+        sUndoEntry *pEntry) {
+    
+    const unsigned long lines = pDeque->lines;
+    sSortKey *pKeyArr = malloc(sizeof(sSortKey)*lines*2);
+    const sSortKey *pSorted;
+    sLineNode *pNode;
+    sLineChain chain = { 0 };
+    unsigned long lineIndex = 0, duplicates = 0, removedIndex = 0;
+    
+    pEntry->pOrderArr = malloc(sizeof(unsigned long)*lines);
+    if (pKeyArr == NULL || pEntry->pOrderArr == NULL) {
+        free(pKeyArr);
+        free(pEntry->pOrderArr);
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    for (pNode = pDeque->pHead; pNode != NULL; pNode = pNode->pNext) {
+        fillSortKey(pKeyArr+lineIndex, pNode, lineIndex);
+        ++lineIndex;
+    }
+    pSorted = sortKeys(pKeyArr, pKeyArr+lines, lines);
+    
+    // Equal lines lie next to each other once sorted.
+    if (unique) {
+        for (lineIndex = 1; lineIndex < lines; ++lineIndex) {
+            if (compareKeyTexts(pSorted+lineIndex-1,
+                    pSorted+lineIndex) == 0) {
+                ++duplicates;
+                
+            }
+        }
+    }
+    if (duplicates > 0) {
+        pEntry->pRemovedIndexArr = malloc(sizeof(unsigned long)
+            *duplicates);
+        if (pEntry->pRemovedIndexArr == NULL) {
+            free(pKeyArr);
+            free(pEntry->pOrderArr);
+            return ES_ERROR_ALLOCATION_FAIL;
+            
+        }
+    }
+    
+    for (lineIndex = 0; lineIndex < lines; ++lineIndex) {
+        const sSortKey *pKey = pSorted + lineIndex;
+        
+        pEntry->pOrderArr[lineIndex] = pKey->lineIndex;
+        if (duplicates > 0 && lineIndex > 0
+                && compareKeyTexts(pKey-1, pKey) == 0) {
+            appendNodeToChain(pKey->pNode, &pEntry->removed);
+            pEntry->pRemovedIndexArr[removedIndex++] = lineIndex;
+            
+        } else {
+            appendNodeToChain(pKey->pNode, &chain);
+            
+        }
+    }
+    free(pKeyArr);
+    
+    pDeque->pHead = pDeque->pTail = NULL;
+    pDeque->lines = 0;
+    appendChainToDeque(&chain, pDeque);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Sorts runs of lines that fit the memory budget and writes each run
+// to a temporary file. A merge of the runs rebuilds the lines, and the
+// nodes stay until the merge is done, so that a failed merge leaves
+// the document alone. The lines take twice their memory until then,
+// apart from shared text, which the new lines share as well. The
+// lines in their earlier order go to a snapshot, which the undo step
+// reloads.
+static enum EsError sortExternally(sLineDeque *pDeque, int unique,
+        sUndoEntry *pEntry) {
+    
+    const unsigned long lines = pDeque->lines;
+    const unsigned long runLines = ES_SORT_MEMORY_BYTES
+        / (2*sizeof(sSortKey));
+    const unsigned long runs = (lines + runLines - 1) / runLines;
+    sSpillFile snapshot = { 0 };
+    sSpillFile *pRunArr = malloc(sizeof(sSpillFile)*runs);
+    sSortKey *pKeyArr = malloc(sizeof(sSortKey)*runLines*2);
+    sLineNode *pNode = pDeque->pHead;
+    sLineChain chain = { 0 };
+    unsigned long runIndex, lineIndex = 0;
+    enum EsError result = ES_ERROR_SUCCESS;
+    
+    snapshot.hFile = INVALID_HANDLE_VALUE;
+    if (pRunArr == NULL || pKeyArr == NULL) {
+        free(pRunArr);
+        free(pKeyArr);
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    for (runIndex = 0; runIndex < runs; ++runIndex) {
+        pRunArr[runIndex].hFile = INVALID_HANDLE_VALUE;
+        pRunArr[runIndex].pBuffer = NULL;
+    }
+    if (!openSpillFile(&snapshot)) {
+        result = ES_ERROR_TEMPORARY_FILE;
+        
+    }
+    
+    for (runIndex = 0; result == ES_ERROR_SUCCESS && runIndex < runs;
+            ++runIndex) {
+        sSpillFile *pRun = pRunArr + runIndex;
+        const sSortKey *pSorted;
+        unsigned long keys = 0, keyIndex;
+        
+        // The snapshot takes the lines in their earlier order.
+        while (keys < runLines && pNode != NULL) {
+            fillSortKey(pKeyArr+keys, pNode, lineIndex);
+            if ((lineIndex > 0 && !writeSpillFile(&snapshot, "\n", 1))
+                    || !writeSpillFile(&snapshot, LINE_TEXT(&pNode->line),
+                    pNode->line.characters)) {
+                result = ES_ERROR_TEMPORARY_FILE;
+                break;
+                
+            }
+            pNode = pNode->pNext;
+            ++keys;
+            ++lineIndex;
+        }
+        if (result != ES_ERROR_SUCCESS || !openSpillFile(pRun)) {
+            result = ES_ERROR_TEMPORARY_FILE;
+            break;
+            
+        }
+        
+        pSorted = sortKeys(pKeyArr, pKeyArr+keys, keys);
+        for (keyIndex = 0; keyIndex < keys; ++keyIndex) {
+            const sLine *pLine = &pSorted[keyIndex].pNode->line;
+            
+            if (!writeSpillFile(pRun, &pLine->characters,
+                    sizeof(unsigned int))
+                    || !writeSpillFile(pRun, &pSorted[keyIndex].pNode,
+                    sizeof(sLineNode*))
+                    || !writeSpillFile(pRun, LINE_TEXT(pLine),
+                    pLine->characters)) {
+                result = ES_ERROR_TEMPORARY_FILE;
+                break;
+                
+            }
+        }
+        if (result == ES_ERROR_SUCCESS && !flushSpillFile(pRun)) {
+            result = ES_ERROR_TEMPORARY_FILE;
+            
+        }
+        
+        // The merge reads the run through a buffer of its own.
+        free(pRun->pBuffer);
+        pRun->pBuffer = NULL;
+    }
+    free(pKeyArr);
+    
+    if (result == ES_ERROR_SUCCESS && !flushSpillFile(&snapshot)) {
+        result = ES_ERROR_TEMPORARY_FILE;
+        
+    }
+    free(snapshot.pBuffer);
+    snapshot.pBuffer = NULL;
+    
+    if (result == ES_ERROR_SUCCESS) {
+        result = mergeRuns(pRunArr, runs, unique, &chain);
+        
+    }
+    
+    // The merged lines replace the nodes only once they are complete.
+    if (result == ES_ERROR_SUCCESS) {
+        sLineChain previous;
+        
+        previous.pHead = pDeque->pHead;
+        previous.pTail = pDeque->pTail;
+        previous.lines = pDeque->lines;
+        destructLineChain(&previous);
+        pDeque->pHead = pDeque->pTail = NULL;
+        pDeque->lines = 0;
+        appendChainToDeque(&chain, pDeque);
+        
+        pEntry->hSnapshot = snapshot.hFile;
+        snapshot.hFile = INVALID_HANDLE_VALUE;
+        
+    } else {
+        destructLineChain(&chain);
+        
+    }
+    
+    for (runIndex = 0; runIndex < runs; ++runIndex) {
+        closeSpillFile(pRunArr + runIndex);
+    }
+    free(pRunArr);
+    closeSpillFile(&snapshot);
+    
+    return result;
+}
+
+// Merges sorted runs into a chain of new lines. A heap of the runs
+// keeps the run with the least line on top. Equal lines leave the
+// runs in the order of the runs, which keeps the merge stable. Lines
+// with shared text share it with their node, so that interned lines
+// stay interned.
+static enum EsError mergeRuns(sSpillFile *pRunArr, unsigned long runs,
+        int unique, sLineChain *pChain) {
+    
+    unsigned long *pHeapArr = malloc(sizeof(unsigned long)*runs);
+    unsigned long heapSize = 0, runIndex;
+    size_t capacity = ES_SORT_MEMORY_BYTES / runs;
+    enum EsError result = ES_ERROR_SUCCESS;
+    
+    if (pHeapArr == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    if (capacity < ES_SORT_FILE_BUFFER_BYTES) {
+        capacity = ES_SORT_FILE_BUFFER_BYTES;
+        
+    }
+    
+    for (runIndex = 0; runIndex < runs; ++runIndex) {
+        sSpillFile *pRun = pRunArr + runIndex;
+        LARGE_INTEGER position;
+        
+        position.QuadPart = 0;
+        pRun->pBuffer = malloc(sizeof(char)*capacity);
+        pRun->capacity = capacity;
+        pRun->start = pRun->bytes = 0;
+        if (pRun->pBuffer == NULL
+                || !SetFilePointerEx(pRun->hFile, position, NULL,
+                FILE_BEGIN)) {
+            free(pHeapArr);
+            return pRun->pBuffer == NULL ? ES_ERROR_ALLOCATION_FAIL
+                : ES_ERROR_TEMPORARY_FILE;
+            
+        }
+        if (readSpilledLine(pRun)) {
+            pHeapArr[heapSize++] = runIndex;
+            
+        } else if (pRun->failed) {
+            free(pHeapArr);
+            return ES_ERROR_TEMPORARY_FILE;
+            
+        }
+    }
+    for (runIndex = heapSize/2; runIndex-- > 0;) {
+        siftRunDown(pRunArr, pHeapArr, heapSize, runIndex);
+    }
+    
+    while (heapSize > 0) {
+        sSpillFile *pRun = pRunArr + pHeapArr[0];
+        const sLine *pLast = pChain->pTail == NULL ? NULL
+            : &pChain->pTail->line;
+        
+        // Duplicates follow the first of their equal lines directly.
+        if (!unique || pLast == NULL || compareLineTexts(LINE_TEXT(pLast),
+                pLast->characters, pRun->pText, pRun->characters) != 0) {
+            sLineNode *pNode = pRun->pSource->line.shared
+                ? constructSharedLineNode(pRun->pSource)
+                : constructLineNode(pRun->characters);
+            
+            if (pNode == NULL) {
+                result = ES_ERROR_ALLOCATION_FAIL;
+                break;
+                
+            }
+            if (!pNode->line.shared) {
+                memcpy(LINE_TEXT(&pNode->line), pRun->pText,
+                    sizeof(char)*pRun->characters);
+                
+            }
+            appendNodeToChain(pNode, pChain);
+            
+        }
+        
+        if (!readSpilledLine(pRun)) {
+            if (pRun->failed) {
+                result = ES_ERROR_TEMPORARY_FILE;
+                break;
+                
+            }
+            pHeapArr[0] = pHeapArr[--heapSize];
+            
+        }
+        siftRunDown(pRunArr, pHeapArr, heapSize, 0);
+    }
+    
+    free(pHeapArr);
+    
+    return result;
+}
+
+static void siftRunDown(const sSpillFile *pRunArr, unsigned long *pHeapArr,
+        unsigned long heapSize, unsigned long heapIndex) {
+    
+    for (;;) {
+        unsigned long leastIndex = heapIndex;
+        const unsigned long leftIndex = 2*heapIndex + 1;
+        unsigned long swap;
+        
+        if (leftIndex < heapSize && isRunBefore(pRunArr,
+                pHeapArr[leftIndex], pHeapArr[leastIndex])) {
+            leastIndex = leftIndex;
+            
+        }
+        if (leftIndex+1 < heapSize && isRunBefore(pRunArr,
+                pHeapArr[leftIndex+1], pHeapArr[leastIndex])) {
+            leastIndex = leftIndex + 1;
+            
+        }
+        if (leastIndex == heapIndex) {
+            return;
+            
+        }
+        
+        swap = pHeapArr[heapIndex];
+        pHeapArr[heapIndex] = pHeapArr[leastIndex];
+        pHeapArr[leastIndex] = swap;
+        heapIndex = leastIndex;
+    }
+}
+
+static int isRunBefore(const sSpillFile *pRunArr, unsigned long runA,
+        unsigned long runB) {
+    
+    const int order = compareLineTexts(pRunArr[runA].pText,
+        pRunArr[runA].characters, pRunArr[runB].pText,
+        pRunArr[runB].characters);
+    
+    return order < 0 || (order == 0 && runA < runB);
+}
+
+// Sorts one slice of keys per processor and merges the sorted slices
+// in pairs, each pair on a thread of its own, until a single slice
+// remains. Returns the buffer that holds the sorted keys, which is
+// either of the two.
+static sSortKey *sortKeys(sSortKey *pKeys, sSortKey *pScratch,
+        unsigned long keys) {
+    
+    sSortSlice sliceArr[MAXIMUM_WAIT_OBJECTS];
+    unsigned long boundArr[MAXIMUM_WAIT_OBJECTS+1];
+    SYSTEM_INFO systemInfo;
+    unsigned long slices, sliceIndex;
+    
+    GetSystemInfo(&systemInfo);
+    slices = systemInfo.dwNumberOfProcessors;
+    if (slices > MAXIMUM_WAIT_OBJECTS) {
+        slices = MAXIMUM_WAIT_OBJECTS;
+        
+    }
+    if (slices > keys / ES_SORT_PARALLEL_LINES) {
+        slices = keys / ES_SORT_PARALLEL_LINES;
+        
+    }
+    if (slices < 1) {
+        slices = 1;
+        
+    }
+    
+    for (sliceIndex = 0; sliceIndex <= slices; ++sliceIndex) {
+        boundArr[sliceIndex] = (unsigned long)
+            ((unsigned long long) keys*sliceIndex/slices);
+    }
+    for (sliceIndex = 0; sliceIndex < slices; ++sliceIndex) {
+        sliceArr[sliceIndex].merging = FALSE;
+        sliceArr[sliceIndex].pSource = pKeys;
+        sliceArr[sliceIndex].pTarget = pScratch;
+        sliceArr[sliceIndex].firstIndex = boundArr[sliceIndex];
+        sliceArr[sliceIndex].middleIndex = boundArr[sliceIndex+1];
+        sliceArr[sliceIndex].lastIndex = boundArr[sliceIndex+1];
+    }
+    runSlices(sliceArr, slices);
+    
+    while (slices > 1) {
+        const unsigned long pairs = (slices+1) / 2;
+        sSortKey *pSwap;
+        
+        // A slice without a partner merges with nothing, which copies
+        // it into the target.
+        for (sliceIndex = 0; sliceIndex < pairs; ++sliceIndex) {
+            sSortSlice *pSlice = sliceArr + sliceIndex;
+            const unsigned long lastBound = 2*sliceIndex+2 < slices
+                ? 2*sliceIndex+2 : slices;
+            
+            pSlice->merging = TRUE;
+            pSlice->pSource = pKeys;
+            pSlice->pTarget = pScratch;
+            pSlice->firstIndex = boundArr[2*sliceIndex];
+            pSlice->middleIndex = boundArr[2*sliceIndex+1];
+            pSlice->lastIndex = boundArr[lastBound];
+        }
+        runSlices(sliceArr, pairs);
+        
+        for (sliceIndex = 0; sliceIndex < pairs; ++sliceIndex) {
+            boundArr[sliceIndex] = boundArr[2*sliceIndex];
+        }
+        boundArr[pairs] = keys;
+        slices = pairs;
+        
+        pSwap = pKeys;
+        pKeys = pScratch;
+        pScratch = pSwap;
+    }
+    
+    return pKeys;
+}
+
+// The calling thread takes the first slice itself. A slice without a
+// thread also falls back to the calling thread.
+static void runSlices(sSortSlice *pSliceArr, unsigned long slices) {
+    
+    HANDLE threadArr[MAXIMUM_WAIT_OBJECTS];
+    unsigned long sliceIndex;
+    
+    for (sliceIndex = 1; sliceIndex < slices; ++sliceIndex) {
+        threadArr[sliceIndex] = CreateThread(NULL, 0, sortSlice,
+            pSliceArr+sliceIndex, 0, NULL);
+    }
+    sortSlice(pSliceArr);
+    for (sliceIndex = 1; sliceIndex < slices; ++sliceIndex) {
+        if (threadArr[sliceIndex] == NULL) {
+            sortSlice(pSliceArr+sliceIndex);
+            
+        } else {
+            WaitForSingleObject(threadArr[sliceIndex], INFINITE);
+            CloseHandle(threadArr[sliceIndex]);
+            
+        }
+    }
+    
+    return;
+}
+
+static DWORD WINAPI sortSlice(LPVOID pParameter) {
+    
+    const sSortSlice *pSlice = pParameter;
+    const sSortKey *pLeft = pSlice->pSource + pSlice->firstIndex;
+    const sSortKey *pLeftEnd = pSlice->pSource + pSlice->middleIndex;
+    const sSortKey *pRight = pLeftEnd;
+    const sSortKey *pRightEnd = pSlice->pSource + pSlice->lastIndex;
+    sSortKey *pOutput;
+    
+    if (!pSlice->merging) {
+        sortKeyRange(pSlice->pSource + pSlice->firstIndex,
+            pSlice->pTarget + pSlice->firstIndex,
+            pSlice->lastIndex - pSlice->firstIndex, 0);
+        return 0;
+        
+    }
+    
+    pOutput = pSlice->pTarget + pSlice->firstIndex;
+    while (pLeft < pLeftEnd && pRight < pRightEnd) {
+        *pOutput++ = compareSortKeys(pRight, pLeft) < 0
+            ? *pRight++ : *pLeft++;
+    }
+    memcpy(pOutput, pLeft, sizeof(sSortKey)*(pLeftEnd-pLeft));
+    pOutput += pLeftEnd - pLeft;
+    memcpy(pOutput, pRight, sizeof(sSortKey)*(pRightEnd-pRight));
+    
+    return 0;
+}
+
+// Sorts keys by their prefixes alone, which never visits the nodes.
+// Lines with equal prefixes that go on sort by their next prefixes in
+// turn. Past the depth limit, such lines compare in full. The keys
+// hold the prefixes at the depth afterwards.
+static void sortKeyRange(sSortKey *pKeys, sSortKey *pScratch,
+        unsigned long keys, unsigned int depth) {
+    
+    unsigned long firstIndex, lastIndex, keyIndex;
+    
+    if (depth >= ES_SORT_PREFIX_DEPTH) {
+        for (keyIndex = 0; keyIndex < keys; ++keyIndex) {
+            readKeyPrefix(pKeys+keyIndex, 0);
+        }
+        qsort(pKeys, keys, sizeof(sSortKey), compareSortKeys);
+        for (keyIndex = 0; keyIndex < keys; ++keyIndex) {
+            readKeyPrefix(pKeys+keyIndex, depth);
+        }
+        return;
+        
+    }
+    
+    if (keys < ES_SORT_INSERTION_KEYS) {
+        insertionSortKeys(pKeys, keys);
+        
+    } else {
+        radixSortKeys(pKeys, pScratch, keys);
+        
+    }
+    
+    for (firstIndex = 0; firstIndex < keys; firstIndex = lastIndex) {
+        lastIndex = firstIndex + 1;
+        while (lastIndex < keys
+                && pKeys[lastIndex].prefix == pKeys[firstIndex].prefix
+                && pKeys[lastIndex].restCharacters
+                == pKeys[firstIndex].restCharacters) {
+            ++lastIndex;
+        }
+        if (lastIndex - firstIndex < 2 || pKeys[firstIndex].restCharacters
+                <= ES_SORT_PREFIX_CHARACTERS) {
+            continue;
+            
+        }
+        
+        for (keyIndex = firstIndex; keyIndex < lastIndex; ++keyIndex) {
+            readKeyPrefix(pKeys+keyIndex, depth+ES_SORT_PREFIX_CHARACTERS);
+        }
+        sortKeyRange(pKeys+firstIndex, pScratch+firstIndex,
+            lastIndex-firstIndex, depth+ES_SORT_PREFIX_CHARACTERS);
+        for (keyIndex = firstIndex; keyIndex < lastIndex; ++keyIndex) {
+            readKeyPrefix(pKeys+keyIndex, depth);
+        }
+    }
+    
+    return;
+}
+
+// Sorts keys by their prefixes and remaining characters one byte at a
+// time, from the least significant byte on. Each pass keeps the order
+// of keys that tie, so that keys with equal prefixes stay in the order
+// of their earlier indices. Bytes that all keys share take no pass.
+static void radixSortKeys(sSortKey *pKeys, sSortKey *pScratch,
+        unsigned long keys) {
+    
+    // The first digit holds the remaining characters, the others hold
+    // the bytes of the prefix from the last byte on.
+    unsigned long countArr[ES_SORT_PREFIX_CHARACTERS+1][256] = { { 0 } };
+    sSortKey *pSource = pKeys, *pTarget = pScratch;
+    unsigned long keyIndex;
+    unsigned int digit;
+    
+    for (keyIndex = 0; keyIndex < keys; ++keyIndex) {
+        const unsigned long long prefix = pKeys[keyIndex].prefix;
+        
+        ++countArr[0][pKeys[keyIndex].restCharacters];
+        for (digit = 1; digit <= ES_SORT_PREFIX_CHARACTERS; ++digit) {
+            ++countArr[digit][(prefix >> (8*(digit-1))) & 0xFF];
+        }
+    }
+    
+    for (digit = 0; digit <= ES_SORT_PREFIX_CHARACTERS; ++digit) {
+        unsigned long *pCounts = countArr[digit];
+        unsigned long offset = 0, value;
+        sSortKey *pSwap;
+        
+        if (pCounts[digit == 0 ? pSource->restCharacters
+                : (pSource->prefix >> (8*(digit-1))) & 0xFF] == keys) {
+            continue;
+            
+        }
+        
+        // Turn the counts into the start of each value in the target.
+        for (value = 0; value < 256; ++value) {
+            const unsigned long count = pCounts[value];
+            
+            pCounts[value] = offset;
+            offset += count;
+        }
+        for (keyIndex = 0; keyIndex < keys; ++keyIndex) {
+            const sSortKey *pKey = pSource + keyIndex;
+            
+            value = digit == 0 ? pKey->restCharacters
+                : (pKey->prefix >> (8*(digit-1))) & 0xFF;
+            pTarget[pCounts[value]++] = *pKey;
+        }
+        
+        pSwap = pSource;
+        pSource = pTarget;
+        pTarget = pSwap;
+    }
+    
+    if (pSource != pKeys) {
+        memcpy(pKeys, pSource, sizeof(sSortKey)*keys);
+        
+    }
+    
+    return;
+}
+
+// Sorts few keys faster than the passes of a radix sort.
+static void insertionSortKeys(sSortKey *pKeys, unsigned long keys) {
+    
+    unsigned long keyIndex;
+    
+    for (keyIndex = 1; keyIndex < keys; ++keyIndex) {
+        const sSortKey key = pKeys[keyIndex];
+        unsigned long targetIndex = keyIndex;
+        
+        while (targetIndex > 0
+                && compareKeyPrefixes(&key, pKeys+targetIndex-1) < 0) {
+            pKeys[targetIndex] = pKeys[targetIndex-1];
+            --targetIndex;
+        }
+        pKeys[targetIndex] = key;
+    }
+    
+    return;
+}
+
+static void fillSortKey(sSortKey *pKey, sLineNode *pNode,
+        unsigned long lineIndex) {
+    
+    pKey->pNode = pNode;
+    pKey->lineIndex = lineIndex;
+    readKeyPrefix(pKey, 0);
+    
+    return;
+}
+
+// Missing characters count as zero bytes. A line then sorts before
+// the longer lines that it starts through its fewer characters.
+static void readKeyPrefix(sSortKey *pKey, unsigned int depth) {
+    
+    const sLine *pLine = &pKey->pNode->line;
+    const unsigned char *pText = (const unsigned char *) LINE_TEXT(pLine);
+    const unsigned int restCharacters = pLine->characters - depth;
+    unsigned int characterIndex;
+    
+    pKey->prefix = 0;
+    for (characterIndex = 0; characterIndex < ES_SORT_PREFIX_CHARACTERS;
+            ++characterIndex) {
+        pKey->prefix <<= 8;
+        if (characterIndex < restCharacters) {
+            pKey->prefix |= pText[depth+characterIndex];
+            
+        }
+    }
+    pKey->restCharacters = restCharacters > ES_SORT_PREFIX_CHARACTERS
+        ? ES_SORT_PREFIX_CHARACTERS + 1 : restCharacters;
+    
+    return;
+}
+
+static int compareKeyPrefixes(const void *pA, const void *pB) {
+    
+    const sSortKey *pKeyA = pA, *pKeyB = pB;
+    
+    if (pKeyA->prefix != pKeyB->prefix) {
+        return pKeyA->prefix < pKeyB->prefix ? -1 : 1;
+        
+    }
+    if (pKeyA->restCharacters != pKeyB->restCharacters) {
+        return pKeyA->restCharacters < pKeyB->restCharacters ? -1 : 1;
+        
+    }
+    if (pKeyA->lineIndex != pKeyB->lineIndex) {
+        return pKeyA->lineIndex < pKeyB->lineIndex ? -1 : 1;
+        
+    }
+    return 0;
+}
+
+// Orders keys by their text and keys of equal text by their earlier
+// index, which makes the sort stable.
+static int compareSortKeys(const void *pA, const void *pB) {
+    
+    const sSortKey *pKeyA = pA, *pKeyB = pB;
+    const int order = compareKeyTexts(pKeyA, pKeyB);
+    
+    if (order != 0) {
+        return order;
+        
+    }
+    if (pKeyA->lineIndex != pKeyB->lineIndex) {
+        return pKeyA->lineIndex < pKeyB->lineIndex ? -1 : 1;
+        
+    }
+    return 0;
+}
+
+static int compareKeyTexts(const sSortKey *pA, const sSortKey *pB) {
+    if (pA->prefix != pB->prefix) {
+        return pA->prefix < pB->prefix ? -1 : 1;
+        
+    }
+    return compareLineTexts(LINE_TEXT(&pA->pNode->line),
+        pA->pNode->line.characters, LINE_TEXT(&pB->pNode->line),
+        pB->pNode->line.characters);
+}
+
+static int compareLineTexts(const char *pA, unsigned int charactersA,
+        const char *pB, unsigned int charactersB) {
+    
+    const int order = memcmp(pA, pB, charactersA < charactersB
+        ? charactersA : charactersB);
+    
+    if (order != 0) {
+        return order < 0 ? -1 : 1;
+        
+    }
+    if (charactersA != charactersB) {
+        return charactersA < charactersB ? -1 : 1;
+        
+    }
+    return 0;
+}
+
+// Tells whether a filter drops the line, which happens when containing
+// the pattern differs from what the filter keeps.
+static int dropsLine(const sLine *pLine, const char *pPattern,
+        unsigned int patternCharacters, int keepMatches) {
+    
+    const char *pText = LINE_TEXT(pLine);
+    const char *pEnd = pText + pLine->characters;
+    int contains = FALSE;
+    
+    while ((size_t) (pEnd-pText) >= patternCharacters) {
+        pText = memchr(pText, pPattern[0],
+            (size_t) (pEnd-pText) - patternCharacters + 1);
+        if (pText == NULL) {
+            break;
+            
+        }
+        if (memcmp(pText+1, pPattern+1, patternCharacters-1) == 0) {
+            contains = TRUE;
+            break;
+            
+        }
+        ++pText;
+    }
+    
+    return !contains != !keepMatches;
+}
+
+// Operations on the whole document move the write head to the first
+// line and damage every line.
+static void damageWholeDeque(sLineDeque *pDeque,
+        unsigned long previousLines, sDamage *pDamage) {
+    
+    pDeque->writeHead.pNode = pDeque->pHead;
+    pDeque->writeHead.lineIndex = 0;
+    pDeque->writeHead.characterIndex = 0;
+    
+    pDamage->firstLineIndex = 0;
+    pDamage->lastLineIndex = pDeque->lines - 1;
+    pDamage->lineDelta = (signed long) pDeque->lines
+        - (signed long) previousLines;
+    
+    return;
+}
+
+static sUndoEntry *constructUndoEntry(enum EsUndoKind kind,
+        unsigned long lines) {
+    
+    sUndoEntry *pEntry = SALLOC(sUndoEntry);
+    
+    if (pEntry == NULL) {
+        return NULL;
+        
+    }
+    
+    pEntry->pPrev = NULL;
+    pEntry->kind = kind;
+    pEntry->edits = 0;
+    pEntry->pEdits = NULL;
+    pEntry->pText = NULL;
+    pEntry->pOrderArr = NULL;
+    pEntry->lines = lines;
+    pEntry->removed.pHead = pEntry->removed.pTail = NULL;
+    pEntry->removed.lines = 0;
+    pEntry->pRemovedIndexArr = NULL;
+    pEntry->hSnapshot = INVALID_HANDLE_VALUE;
+    
+    return pEntry;
+}
+
+// Creates a file among the temporary files of the user, which the
+// system deletes as soon as its handle closes.
+static HANDLE createTemporaryFile(void) {
+    
+    char folder[MAX_PATH+1], path[MAX_PATH+1];
+    HANDLE hFile;
+    
+    if (GetTempPath(sizeof(folder), folder) == 0
+            || GetTempFileName(folder, "es", 0, path) == 0) {
+        return INVALID_HANDLE_VALUE;
+        
+    }
+    
+    hFile = CreateFile(path,
+        GENERIC_READ|GENERIC_WRITE,
+        0, /*No other process needs the file.*/
+        NULL,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_DELETE_ON_CLOSE,
+        NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        DeleteFile(path);
+        
+    }
+    
+    return hFile;
+}
+
+static int openSpillFile(sSpillFile *pFile) {
+    
+    pFile->pBuffer = malloc(sizeof(char)*ES_SORT_FILE_BUFFER_BYTES);
+    pFile->capacity = ES_SORT_FILE_BUFFER_BYTES;
+    pFile->start = pFile->bytes = 0;
+    pFile->pText = NULL;
+    pFile->characters = 0;
+    pFile->pSource = NULL;
+    pFile->failed = FALSE;
+    if (pFile->pBuffer == NULL) {
+        pFile->hFile = INVALID_HANDLE_VALUE;
+        return FALSE;
+        
+    }
+    
+    pFile->hFile = createTemporaryFile();
+    
+    return pFile->hFile != INVALID_HANDLE_VALUE;
+}
+
+static void closeSpillFile(sSpillFile *pFile) {
+    
+    free(pFile->pBuffer);
+    pFile->pBuffer = NULL;
+    if (pFile->hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(pFile->hFile);
+        pFile->hFile = INVALID_HANDLE_VALUE;
+        
+    }
+    
+    return;
+}
+
+static int writeSpillFile(sSpillFile *pFile, const void *pBytes,
+        size_t bytes) {
+    
+    const char *pNext = pBytes;
+    
+    while (bytes > 0) {
+        size_t copiedBytes = pFile->capacity - pFile->bytes;
+        
+        if (copiedBytes == 0) {
+            if (!flushSpillFile(pFile)) {
+                return FALSE;
+                
+            }
+            continue;
+            
+        }
+        
+        if (copiedBytes > bytes) {
+            copiedBytes = bytes;
+            
+        }
+        memcpy(pFile->pBuffer+pFile->bytes, pNext, copiedBytes);
+        pFile->bytes += copiedBytes;
+        pNext += copiedBytes;
+        bytes -= copiedBytes;
+    }
+    
+    return TRUE;
+}
+
+static int flushSpillFile(sSpillFile *pFile) {
+    
+    size_t flushedBytes = 0;
+    
+    while (flushedBytes < pFile->bytes) {
+        DWORD writtenBytes;
+        
+        if (!WriteFile(pFile->hFile, pFile->pBuffer+flushedBytes,
+                (DWORD) (pFile->bytes-flushedBytes), &writtenBytes, NULL)
+                || writtenBytes == 0) {
+            return FALSE;
+            
+        }
+        flushedBytes += writtenBytes;
+    }
+    pFile->bytes = 0;
+    
+    return TRUE;
+}
+
+// Makes the given number of bytes available from the start of the
+// buffer. A line longer than the buffer grows it. Returns FALSE when
+// the file ends first.
+static int fillSpillFile(sSpillFile *pFile, size_t bytes) {
+    
+    if (pFile->bytes - pFile->start >= bytes) {
+        return TRUE;
+        
+    }
+    
+    memmove(pFile->pBuffer, pFile->pBuffer+pFile->start,
+        pFile->bytes-pFile->start);
+    pFile->bytes -= pFile->start;
+    pFile->start = 0;
+    
+    if (bytes > pFile->capacity) {
+        char *pGrown = realloc(pFile->pBuffer, sizeof(char)*bytes);
+        
+        if (pGrown == NULL) {
+            pFile->failed = TRUE;
+            return FALSE;
+            
+        }
+        pFile->pBuffer = pGrown;
+        pFile->capacity = bytes;
+        
+    }
+    
+    while (pFile->bytes < bytes) {
+        DWORD readBytes;
+        
+        if (!ReadFile(pFile->hFile, pFile->pBuffer+pFile->bytes,
+                (DWORD) (pFile->capacity-pFile->bytes), &readBytes, NULL)) {
+            pFile->failed = TRUE;
+            return FALSE;
+            
+        }
+        if (readBytes == 0) {
+            return FALSE;
+            
+        }
+        pFile->bytes += readBytes;
+    }
+    
+    return TRUE;
+}
+
+// Moves the reader to the next line of a run. Returns FALSE at the end
+// of the run, and marks the file as failed when the run breaks off.
+static int readSpilledLine(sSpillFile *pFile) {
+    
+    const size_t headerBytes = sizeof(unsigned int) + sizeof(sLineNode*);
+    unsigned int characters;
+    
+    if (!fillSpillFile(pFile, headerBytes)) {
+        if (pFile->bytes > pFile->start) {
+            pFile->failed = TRUE;
+            
+        }
+        return FALSE;
+        
+    }
+    memcpy(&characters, pFile->pBuffer+pFile->start, sizeof(unsigned int));
+    memcpy(&pFile->pSource, pFile->pBuffer+pFile->start
+        + sizeof(unsigned int), sizeof(sLineNode*));
+    
+    if (!fillSpillFile(pFile, headerBytes+characters)) {
+        pFile->failed = TRUE;
+        return FALSE;
+        
+    }
+    pFile->pText = pFile->pBuffer + pFile->start + headerBytes;
+    pFile->characters = characters;
+    pFile->start += headerBytes + characters;
+    
+    return TRUE;
+}
@@ -0,0 +1,26 @@
+#include "edit_manager.h"
+
+#ifndef _HEADER_SORT_MANAGER
+
+// Memory that a sort may take besides the lines themselves. Documents
+// with more lines sort in runs that spill to temporary files.
+#define ES_SORT_MEMORY_BYTES (256*1024*1024)
+// Slices with fewer lines stay on the thread that sorts them, since
+// starting a thread costs more than sorting them.
+#define ES_SORT_PARALLEL_LINES (16*1024)
+// Characters that a sort compares through prefixes in integers, after
+// which lines with equal prefixes compare in full.
+#define ES_SORT_PREFIX_DEPTH 64
+// Keys with equal prefixes that sort without the passes of a radix
+// sort, which cost more for few keys.
+#define ES_SORT_INSERTION_KEYS 32
+// Bytes that a temporary file buffers at the least.
+#define ES_SORT_FILE_BUFFER_BYTES (64*1024)
+
+enum EsError sortDequeLines(sLineDeque *pDeque, int unique,
+    sDamage *pDamage);
+enum EsError filterDequeLines(sLineDeque *pDeque, const char *pPattern,
+    unsigned int patternCharacters, int keepMatches, sDamage *pDamage);
+
+#define _HEADER_SORT_MANAGER
+#endif
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include "task_scheduler.h"
+
+static void releaseTask(sTask *pTask);
+
+void constructTaskScheduler(sTaskScheduler *pScheduler,
+        unsigned long long (*pClock)(void), int (*pInputPending)(void)) {
+    
+    unsigned int priority;
+    
+    for (priority = 0; priority < ES_TASK_PRIORITIES; ++priority) {
+        pScheduler->pHeadArr[priority] = NULL;
+        pScheduler->pTailArr[priority] = NULL;
+    }
+    pScheduler->pClock = pClock;
+    pScheduler->pInputPending = pInputPending;
+    
+    return;
+}
+
+void destructTaskScheduler(sTaskScheduler *pScheduler) {
+    
+    unsigned int priority;
+    
+    for (priority = 0; priority < ES_TASK_PRIORITIES; ++priority) {
+        while (pScheduler->pHeadArr[priority] != NULL) {
+            sTask *pTask = pScheduler->pHeadArr[priority];
+            
+            pScheduler->pHeadArr[priority] = pTask->pNext;
+            releaseTask(pTask);
+        }
+        pScheduler->pTailArr[priority] = NULL;
+    }
+    
+    return;
+}
+
+// Queues a task behind the tasks of the same priority. Returns zero
+// when the task cannot be queued, in which case the caller still owns
+// the context.
+int scheduleTask(sTaskScheduler *pScheduler, unsigned int priority,
+        const void *pOwner, int (*pStep)(void *pContext),
+        void (*pRelease)(void *pContext), void *pContext) {
+    
+    sTask *pTask = malloc(sizeof(sTask));
+    
+    if (pTask == NULL) {
+        return 0;
+        
+    }
+    if (priority >= ES_TASK_PRIORITIES) {
+        priority = ES_TASK_PRIORITIES - 1;
+        
+    }
+    
+    pTask->pNext = NULL;
+    pTask->pStep = pStep;
+    pTask->pRelease = pRelease;
+    pTask->pContext = pContext;
+    pTask->pOwner = pOwner;
+    
+    if (pScheduler->pTailArr[priority] == NULL) {
+        pScheduler->pHeadArr[priority] = pTask;
+        
+    } else {
+        pScheduler->pTailArr[priority]->pNext = pTask;
+        
+    }
+    pScheduler->pTailArr[priority] = pTask;
+    
+    return 1;
+}
+
+// Drops every task of the owner without running it again. Owners call
+// this before they change whatever their tasks refer to.
+void cancelTasks(sTaskScheduler *pScheduler, const void *pOwner) {
+    
+    unsigned int priority;
+    
+    for (priority = 0; priority < ES_TASK_PRIORITIES; ++priority) {
+        sTask **ppLink = pScheduler->pHeadArr + priority;
+        
+        pScheduler->pTailArr[priority] = NULL;
+        while (*ppLink != NULL) {
+            sTask *pTask = *ppLink;
+            
+            if (pTask->pOwner == pOwner) {
+                *ppLink = pTask->pNext;
+                releaseTask(pTask);
+                
+            } else {
+                pScheduler->pTailArr[priority] = pTask;
+                ppLink = &pTask->pNext;
+                
+            }
+        }
+    }
+    
+    return;
+}
+
+// Runs steps of the most urgent tasks until the budget runs out or
+// input arrives. Tasks of the same priority take turns. Returns
+// non-zero while tasks remain.
+int runTaskSlice(sTaskScheduler *pScheduler,
+        unsigned long long budgetMicroseconds) {
+    
+    const unsigned long long start = pScheduler->pClock();
+    unsigned int priority = 0;
+    
+    while (priority < ES_TASK_PRIORITIES) {
+        sTask *pTask = pScheduler->pHeadArr[priority];
+        
+        if (pTask == NULL) {
+            ++priority;
+            continue;
+            
+        }
+        
+        // Take the task off the queue while it runs, so that its step
+        // may schedule or cancel other tasks.
+        pScheduler->pHeadArr[priority] = pTask->pNext;
+        if (pScheduler->pHeadArr[priority] == NULL) {
+            pScheduler->pTailArr[priority] = NULL;
+            
+        }
+        pTask->pNext = NULL;
+        
+        if (pTask->pStep(pTask->pContext)) {
+            if (pScheduler->pTailArr[priority] == NULL) {
+                pScheduler->pHeadArr[priority] = pTask;
+                
+            } else {
+                pScheduler->pTailArr[priority]->pNext = pTask;
+                
+            }
+            pScheduler->pTailArr[priority] = pTask;
+            
+        } else {
+            releaseTask(pTask);
+            
+        }
+        
+        if (pScheduler->pClock() - start >= budgetMicroseconds
+                || (pScheduler->pInputPending != NULL
+                && pScheduler->pInputPending())) {
+            break;
+            
+        }
+        
+        // A step may have queued more urgent work.
+        priority = 0;
+    }
+    
+    for (priority = 0; priority < ES_TASK_PRIORITIES; ++priority) {
+        if (pScheduler->pHeadArr[priority] != NULL) {
+            return 1;
+            
+        }
+    }
+    
+    return 0;
+}
+
+static void releaseTask(sTask *pTask) {
+    
+    if (pTask->pRelease != NULL) {
+        pTask->pRelease(pTask->pContext);
+        
+    }
+    free(pTask);
+    
+    return;
+}
@@ -0,0 +1,48 @@
+#include <stddef.h>
+
+#ifndef _HEADER_TASK_SCHEDULER
+
+// The scheduler runs on the thread of the message loop while no input
+// waits. It stays free of platform headers, so it also runs headless.
+
+// Tasks with a lower priority run before tasks with a higher one.
+#define ES_TASK_PRIORITY_VISIBLE 0
+#define ES_TASK_PRIORITY_BACKGROUND 1
+#define ES_TASK_PRIORITIES 2
+
+// Time that background tasks may take before the loop looks for
+// messages again.
+#define ES_TASK_SLICE_MICROSECONDS 4000
+
+// A resumable piece of work. Each step does a bounded amount of work
+// and returns non-zero while work remains. Tasks of the same owner
+// share their fate, so that a change to the owner cancels all of them.
+typedef struct Task {
+    struct Task *pNext;
+    int (*pStep)(void *pContext);
+    void (*pRelease)(void *pContext);   // Frees the context, if set.
+    void *pContext;
+    const void *pOwner;
+} sTask;
+
+// The platform supplies a clock in microseconds and tells whether
+// input waits, which ends a slice early.
+typedef struct {
+    sTask *pHeadArr[ES_TASK_PRIORITIES];
+    sTask *pTailArr[ES_TASK_PRIORITIES];
+    unsigned long long (*pClock)(void);
+    int (*pInputPending)(void);
+} sTaskScheduler;
+
+void constructTaskScheduler(sTaskScheduler *pScheduler,
+    unsigned long long (*pClock)(void), int (*pInputPending)(void));
+void destructTaskScheduler(sTaskScheduler *pScheduler);
+int scheduleTask(sTaskScheduler *pScheduler, unsigned int priority,
+    const void *pOwner, int (*pStep)(void *pContext),
+    void (*pRelease)(void *pContext), void *pContext);
+void cancelTasks(sTaskScheduler *pScheduler, const void *pOwner);
+int runTaskSlice(sTaskScheduler *pScheduler,
+    unsigned long long budgetMicroseconds);
+
+#define _HEADER_TASK_SCHEDULER
+#endif
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include "../task_scheduler.h"
+
+// Runs the scheduler headless against a fake clock. Build and run it
+// from this folder with:
+//     gcc -std=c99 -Wall -o task_scheduler_test task_scheduler_test.c
+//         ../task_scheduler.c && ./task_scheduler_test
+
+typedef struct {
+    char name;
+    unsigned int stepsLeft;
+    int released;
+} sTestTask;
+
+static unsigned long long gNow = 0;
+static unsigned long long gStepMicroseconds = 0;
+static int gInputAfterSteps = -1;
+static char gRunArr[64];
+static unsigned int gRuns = 0;
+static int gFailures = 0;
+
+static unsigned long long fakeClock(void);
+static int fakeInputPending(void);
+static int stepTestTask(void *pContext);
+static void releaseTestTask(void *pContext);
+static void resetRuns(void);
+static void expectRuns(const char *pTest, const char *pExpected);
+static void expectTrue(const char *pTest, int condition);
+static void testSliceBudget(void);
+static void testPriorityOrder(void);
+static void testCancelByOwner(void);
+static void testInputPreemption(void);
+
+int main(void) {
+    
+    testSliceBudget();
+    testPriorityOrder();
+    testCancelByOwner();
+    testInputPreemption();
+    
+    if (gFailures != 0) {
+        printf("%d check(s) failed\n", gFailures);
+        return 1;
+        
+    }
+    printf("all checks passed\n");
+    
+    return 0;
+}
+
+static unsigned long long fakeClock(void) {
+    
+    return gNow;
+}
+
+// Reports input once the given number of steps ran, like a key press
+// that arrives in the middle of a slice.
+static int fakeInputPending(void) {
+    
+    return gInputAfterSteps >= 0 && gRuns >= (unsigned int)gInputAfterSteps;
+}
+
+// Each step records the task name and moves the fake clock forward.
+static int stepTestTask(void *pContext) {
+    
+    sTestTask *pTask = pContext;
+    
+    if (gRuns < sizeof(gRunArr) - 1) {
+        gRunArr[gRuns] = pTask->name;
+        
+    }
+    ++gRuns;
+    gNow += gStepMicroseconds;
+    
+    return --pTask->stepsLeft != 0;
+}
+
+static void releaseTestTask(void *pContext) {
+    
+    ((sTestTask*)pContext)->released = 1;
+    
+    return;
+}
+
+static void resetRuns(void) {
+    
+    gRuns = 0;
+    gRunArr[0] = '\0';
+    gInputAfterSteps = -1;
+    
+    return;
+}
+
+static void expectRuns(const char *pTest, const char *pExpected) {
+    
+    unsigned int i = 0;
+    
+    gRunArr[gRuns < sizeof(gRunArr) ? gRuns : sizeof(gRunArr) - 1] = '\0';
+    while (pExpected[i] != '\0' && pExpected[i] == gRunArr[i]) {
+        ++i;
+    }
+    if (pExpected[i] != gRunArr[i]) {
+        printf("%s: ran \"%s\", expected \"%s\"\n", pTest, gRunArr,
+            pExpected);
+        ++gFailures;
+        
+    }
+    
+    return;
+}
+
+static void expectTrue(const char *pTest, int condition) {
+    
+    if (!condition) {
+        printf("%s: check failed\n", pTest);
+        ++gFailures;
+        
+    }
+    
+    return;
+}
+
+// A slice stops at the first step that uses up the budget, and the
+// next slice resumes where it stopped.
+static void testSliceBudget(void) {
+    
+    sTaskScheduler scheduler;
+    sTestTask task = {'a', 10, 0};
+    int remaining;
+    
+    constructTaskScheduler(&scheduler, fakeClock, fakeInputPending);
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_BACKGROUND, &task,
+        stepTestTask, releaseTestTask, &task);
+    
+    resetRuns();
+    gStepMicroseconds = 1000;
+    remaining = runTaskSlice(&scheduler, 3000);
+    expectRuns("slice budget", "aaa");
+    expectTrue("slice budget remaining", remaining);
+    
+    resetRuns();
+    gStepMicroseconds = 0;
+    remaining = runTaskSlice(&scheduler, 3000);
+    expectRuns("slice budget finish", "aaaaaaa");
+    expectTrue("slice budget done", !remaining && task.released);
+    
+    destructTaskScheduler(&scheduler);
+    
+    return;
+}
+
+// Visible tasks run before background ones, and tasks of the same
+// priority take turns.
+static void testPriorityOrder(void) {
+    
+    sTaskScheduler scheduler;
+    sTestTask backgroundTask = {'b', 2, 0};
+    sTestTask firstTask = {'v', 2, 0};
+    sTestTask secondTask = {'w', 2, 0};
+    
+    constructTaskScheduler(&scheduler, fakeClock, fakeInputPending);
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_BACKGROUND, &backgroundTask,
+        stepTestTask, releaseTestTask, &backgroundTask);
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_VISIBLE, &firstTask,
+        stepTestTask, releaseTestTask, &firstTask);
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_VISIBLE, &secondTask,
+        stepTestTask, releaseTestTask, &secondTask);
+    
+    resetRuns();
+    gStepMicroseconds = 0;
+    expectTrue("priority done", !runTaskSlice(&scheduler, 1000));
+    expectRuns("priority order", "vwvwbb");
+    
+    destructTaskScheduler(&scheduler);
+    
+    return;
+}
+
+// Cancelling an owner releases its tasks and leaves the others queued
+// in their order.
+static void testCancelByOwner(void) {
+    
+    sTaskScheduler scheduler;
+    const int ownerA = 0, ownerB = 0;
+    sTestTask firstTask = {'a', 3, 0};
+    sTestTask otherTask = {'b', 3, 0};
+    sTestTask lastTask = {'c', 3, 0};
+    
+    constructTaskScheduler(&scheduler, fakeClock, fakeInputPending);
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_BACKGROUND, &ownerA,
+        stepTestTask, releaseTestTask, &firstTask);
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_BACKGROUND, &ownerB,
+        stepTestTask, releaseTestTask, &otherTask);
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_BACKGROUND, &ownerA,
+        stepTestTask, releaseTestTask, &lastTask);
+    
+    cancelTasks(&scheduler, &ownerA);
+    expectTrue("cancel releases", firstTask.released && lastTask.released
+        && !otherTask.released);
+    
+    // A task queued after the cancel goes behind the survivor.
+    lastTask.released = 0;
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_BACKGROUND, &ownerA,
+        stepTestTask, releaseTestTask, &lastTask);
+    
+    resetRuns();
+    gStepMicroseconds = 0;
+    expectTrue("cancel done", !runTaskSlice(&scheduler, 1000));
+    expectRuns("cancel by owner", "bcbcbc");
+    
+    destructTaskScheduler(&scheduler);
+    
+    return;
+}
+
+// Input ends a slice after the step that is running, even with budget
+// left.
+static void testInputPreemption(void) {
+    
+    sTaskScheduler scheduler;
+    sTestTask task = {'a', 10, 0};
+    
+    constructTaskScheduler(&scheduler, fakeClock, fakeInputPending);
+    scheduleTask(&scheduler, ES_TASK_PRIORITY_BACKGROUND, &task,
+        stepTestTask, releaseTestTask, &task);
+    
+    resetRuns();
+    gStepMicroseconds = 0;
+    gInputAfterSteps = 2;
+    expectTrue("input remaining", runTaskSlice(&scheduler, 1000));
+    expectRuns("input preemption", "aa");
+    
+    // Destroying the scheduler releases the unfinished task.
+    destructTaskScheduler(&scheduler);
+    expectTrue("input release", task.released);
+    
+    return;
+}
@@ -0,0 +1,561 @@
+#include <stdlib.h>
+#include <string.h>
+#include "wrap_layout.h"
+
+#define LOWEST_BIT(index) ((index) & (~(index) + 1))
+
+// Empty slots that a rebuild leaves for the edits after it.
+#define WRAP_GAP_SLOTS(lines) ((lines) / 64 + 64)
+
+static enum EsError reserveWrapLines(sWrapLayout *pLayout,
+    unsigned long lines);
+static enum EsError rebuildWrapLines(sWrapLayout *pLayout,
+    unsigned long firstLineIndex, unsigned long removedLines,
+    unsigned long insertedLines);
+static int rebuildCostsLess(const sWrapLayout *pLayout,
+    unsigned long updates);
+static void buildWrapTree(sWrapLayout *pLayout);
+static void setLineRows(sWrapLayout *pLayout, unsigned long slot,
+    unsigned long rows);
+static void moveWrapGap(sWrapLayout *pLayout, unsigned long lineIndex);
+static void moveWrapSlot(sWrapLayout *pLayout, unsigned long fromSlot,
+    unsigned long toSlot);
+static void appendWrapLine(sWrapLayout *pLayout);
+static unsigned long slotOfLine(const sWrapLayout *pLayout,
+    unsigned long lineIndex);
+static unsigned long prefixRows(const sWrapLayout *pLayout,
+    unsigned long slots);
+
+// Every line starts as a single dirty row, so that turning wrapping on
+// never touches the text of the lines.
+enum EsError constructWrapLayout(sWrapLayout *pLayout, unsigned long lines,
+        unsigned short columns) {
+    
+    unsigned long lineIndex;
+    
+    pLayout->lines = 0;
+    pLayout->gapLineIndex = 0;
+    pLayout->gapSlots = 0;
+    pLayout->capacity = 0;
+    pLayout->columns = columns > 0 ? columns : 1;
+    pLayout->pTreeArr = NULL;
+    pLayout->pRowsArr = NULL;
+    pLayout->pDirtyArr = NULL;
+    
+    if (reserveWrapLines(pLayout, lines) != ES_ERROR_SUCCESS) {
+        destructWrapLayout(pLayout);
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    pLayout->lines = pLayout->gapLineIndex = lines;
+    for (lineIndex = 0; lineIndex < lines; ++lineIndex) {
+        pLayout->pRowsArr[lineIndex] = 1;
+    }
+    memset(pLayout->pDirtyArr, TRUE, lines);
+    buildWrapTree(pLayout);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+void destructWrapLayout(sWrapLayout *pLayout) {
+    free(pLayout->pTreeArr);
+    free(pLayout->pRowsArr);
+    free(pLayout->pDirtyArr);
+    pLayout->pTreeArr = NULL;
+    pLayout->pRowsArr = NULL;
+    pLayout->pDirtyArr = NULL;
+    pLayout->lines = pLayout->capacity = 0;
+    pLayout->gapLineIndex = pLayout->gapSlots = 0;
+    return;
+}
+
+// A new width only marks the lines as dirty. Their previous row counts
+// stay as estimates until each line is resolved again.
+void resizeWrapLayout(sWrapLayout *pLayout, unsigned short columns) {
+    
+    if (columns < 1) {
+        columns = 1;
+        
+    }
+    if (columns == pLayout->columns) {
+        return;
+        
+    }
+    
+    pLayout->columns = columns;
+    memset(pLayout->pDirtyArr, TRUE, pLayout->lines + pLayout->gapSlots);
+    
+    return;
+}
+
+// Replaces lines after an edit that changed the line count. Inserted
+// lines start dirty. The gap moves to the edit, the removed lines join
+// it and the inserted lines leave it, which costs logarithmic time per
+// slot that changes. Edits far from the gap, or larger than it, rebuild
+// the layout in linear time instead. Lines that arrive at the end
+// extend the tree without moving the gap.
+enum EsError replaceWrapLines(sWrapLayout *pLayout,
+        unsigned long firstLineIndex, unsigned long removedLines,
+        unsigned long insertedLines) {
+    
+    const unsigned long tailLines = pLayout->lines - firstLineIndex
+        - removedLines;
+    const unsigned long distance = pLayout->gapSlots == 0 ? 0
+        : firstLineIndex > pLayout->gapLineIndex
+        ? firstLineIndex - pLayout->gapLineIndex
+        : pLayout->gapLineIndex - firstLineIndex;
+    unsigned long lineIndex;
+    
+    // A tree node never covers slots after it, so dropping the last
+    // lines only shortens the tree. The gap goes with them when it
+    // comes after the first of them.
+    if (tailLines == 0) {
+        if (pLayout->gapLineIndex >= firstLineIndex) {
+            pLayout->gapLineIndex = firstLineIndex;
+            pLayout->gapSlots = 0;
+            
+        }
+        if (reserveWrapLines(pLayout, firstLineIndex + pLayout->gapSlots
+                + insertedLines) != ES_ERROR_SUCCESS) {
+            return ES_ERROR_ALLOCATION_FAIL;
+            
+        }
+        
+        pLayout->lines = firstLineIndex;
+        for (lineIndex = 0; lineIndex < insertedLines; ++lineIndex) {
+            appendWrapLine(pLayout);
+        }
+        return ES_ERROR_SUCCESS;
+        
+    }
+    
+    if (insertedLines > pLayout->gapSlots + removedLines
+            || rebuildCostsLess(pLayout, 2*distance + removedLines 
+            + insertedLines)) {
+        return rebuildWrapLines(pLayout, firstLineIndex, removedLines,
+            insertedLines);
+        
+    }
+    
+    moveWrapGap(pLayout, firstLineIndex);
+    for (lineIndex = 0; lineIndex < removedLines; ++lineIndex) {
+        setLineRows(pLayout, 
+            firstLineIndex + pLayout->gapSlots + lineIndex, 0);
+    }
+    pLayout->gapSlots += removedLines;
+    pLayout->lines -= removedLines;
+    
+    for (lineIndex = 0; lineIndex < insertedLines; ++lineIndex) {
+        setLineRows(pLayout, firstLineIndex + lineIndex, 1);
+        pLayout->pDirtyArr[firstLineIndex + lineIndex] = TRUE;
+    }
+    pLayout->gapLineIndex += insertedLines;
+    pLayout->gapSlots -= insertedLines;
+    pLayout->lines += insertedLines;
+    
+    // Lines that leave the start of the document, as in the follow
+    // mode, keep growing the gap. Giving it up once it outnumbers the
+    // lines spreads the cost of the rebuild over the dropped lines.
+    if (pLayout->gapSlots > pLayout->lines 
+            + WRAP_GAP_SLOTS(pLayout->lines)) {
+        return rebuildWrapLines(pLayout, pLayout->gapLineIndex, 0, 0);
+        
+    }
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Marks lines whose text changed without changing the line count.
+void invalidateWrapLines(sWrapLayout *pLayout, unsigned long firstLineIndex,
+        unsigned long lastLineIndex) {
+    
+    if (lastLineIndex >= pLayout->lines) {
+        lastLineIndex = pLayout->lines - 1;
+        
+    }
+    if (firstLineIndex > lastLineIndex) {
+        return;
+        
+    }
+    
+    // The gap may split the range in two.
+    if (firstLineIndex < pLayout->gapLineIndex) {
+        const unsigned long lastBeforeGap = 
+            lastLineIndex < pLayout->gapLineIndex 
+            ? lastLineIndex : pLayout->gapLineIndex - 1;
+        
+        memset(pLayout->pDirtyArr + firstLineIndex, TRUE,
+            lastBeforeGap - firstLineIndex + 1);
+        firstLineIndex = lastBeforeGap + 1;
+        
+    }
+    if (firstLineIndex <= lastLineIndex) {
+        memset(pLayout->pDirtyArr + pLayout->gapSlots + firstLineIndex, 
+            TRUE, lastLineIndex - firstLineIndex + 1);
+        
+    }
+    
+    return;
+}
+
+// Computes the wrap points of dirty lines, starting at the line that
+// the node holds. Returns the number of lines that the call visited,
+// which is less than requested at the end of the deque.
+unsigned long resolveWrapLines(sWrapLayout *pLayout,
+        unsigned long lineIndex, const sLineNode *pNode,
+        unsigned long lines) {
+    
+    unsigned long visitedLines = 0;
+    
+    while (visitedLines < lines && pNode != NULL
+            && lineIndex < pLayout->lines) {
+        
+        const unsigned long slot = slotOfLine(pLayout, lineIndex);
+        
+        if (pLayout->pDirtyArr[slot]) {
+            const char *pText = LINE_TEXT(&pNode->line);
+            unsigned int rowStart = 0;
+            unsigned long rows = 1;
+            
+            while ((rowStart = nextWrapBreak(pText,
+                    pNode->line.characters, rowStart, pLayout->columns))
+                    < pNode->line.characters) {
+                ++rows;
+            }
+            
+            setLineRows(pLayout, slot, rows);
+            pLayout->pDirtyArr[slot] = FALSE;
+            
+        }
+        
+        pNode = pNode->pNext;
+        ++lineIndex;
+        ++visitedLines;
+    }
+    
+    return visitedLines;
+}
+
+// Resolves the next lines of the range. Returns zero once the range
+// is done, which ends the task.
+int stepWrapResolver(void *pContext) {
+    
+    sWrapResolver *pResolver = pContext;
+    unsigned long steps;
+    
+    for (steps = 0; steps < ES_WRAP_RESOLVE_STEP_LINES 
+            && pResolver->pNode != NULL
+            && pResolver->lineIndex < pResolver->lastLineIndex; ++steps) {
+        resolveWrapLines(pResolver->pLayout, pResolver->lineIndex, 
+            pResolver->pNode, 1);
+        pResolver->pNode = pResolver->pNode->pNext;
+        ++(pResolver->lineIndex);
+    }
+    
+    return pResolver->pNode != NULL 
+        && pResolver->lineIndex < pResolver->lastLineIndex;
+}
+
+// The first visual row of a line is the sum of the rows of the lines
+// before it.
+unsigned long rowOfLine(const sWrapLayout *pLayout,
+        unsigned long lineIndex) {
+    
+    if (lineIndex > pLayout->lines) {
+        lineIndex = pLayout->lines;
+        
+    }
+    
+    // The slots of the gap have no rows.
+    return prefixRows(pLayout, slotOfLine(pLayout, lineIndex));
+}
+
+// Descends the tree for the last line that starts at or before the
+// row. Rows past the end fall on the last row of the last line. The
+// slots of the gap have no rows, so the descent passes them.
+unsigned long lineOfRow(const sWrapLayout *pLayout, unsigned long row,
+        unsigned long *pRowInLine) {
+    
+    const unsigned long slots = pLayout->lines + pLayout->gapSlots;
+    unsigned long slot = 0, step = 1;
+    const unsigned long rows = totalWrapRows(pLayout);
+    
+    if (rows == 0) {
+        *pRowInLine = 0;
+        return 0;
+        
+    }
+    if (row >= rows) {
+        row = rows - 1;
+        
+    }
+    
+    while (step <= slots / 2) {
+        step <<= 1;
+    }
+    
+    for (; step > 0; step >>= 1) {
+        if (slot + step <= slots
+                && pLayout->pTreeArr[slot + step] <= row) {
+            slot += step;
+            row -= pLayout->pTreeArr[slot];
+            
+        }
+    }
+    
+    *pRowInLine = row;
+    return slot < pLayout->gapLineIndex ? slot : slot - pLayout->gapSlots;
+}
+
+unsigned long totalWrapRows(const sWrapLayout *pLayout) {
+    return rowOfLine(pLayout, pLayout->lines);
+}
+
+// Finds where the row after the one starting at the given character
+// begins. Rows break after the last space that fits, or in the middle
+// of a word that is longer than a row.
+unsigned int nextWrapBreak(const char *pText, unsigned int characters,
+        unsigned int rowStart, unsigned short columns) {
+    
+    unsigned int characterIndex;
+    
+    if (characters - rowStart <= columns) {
+        return characters;
+        
+    }
+    
+    for (characterIndex = rowStart + columns; characterIndex > rowStart;
+            --characterIndex) {
+        if (pText[characterIndex] == ' ') {
+            return characterIndex + 1;
+            
+        }
+    }
+    
+    return rowStart + columns;
+}
+
+static enum EsError reserveWrapLines(sWrapLayout *pLayout,
+        unsigned long lines) {
+    
+    unsigned long capacity = pLayout->capacity;
+    unsigned long *pTreeArr, *pRowsArr;
+    unsigned char *pDirtyArr;
+    
+    if (lines <= capacity && pLayout->pTreeArr != NULL) {
+        return ES_ERROR_SUCCESS;
+        
+    }
+    
+    while (capacity < lines || capacity == 0) {
+        capacity = capacity*2 + 64;
+    }
+    
+    pTreeArr = realloc(pLayout->pTreeArr,
+        sizeof(unsigned long)*(capacity+1));
+    if (pTreeArr == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    pLayout->pTreeArr = pTreeArr;
+    
+    pRowsArr = realloc(pLayout->pRowsArr, sizeof(unsigned long)*capacity);
+    if (pRowsArr == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    pLayout->pRowsArr = pRowsArr;
+    
+    pDirtyArr = realloc(pLayout->pDirtyArr,
+        sizeof(unsigned char)*capacity);
+    if (pDirtyArr == NULL) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    pLayout->pDirtyArr = pDirtyArr;
+    
+    pLayout->capacity = capacity;
+    return ES_ERROR_SUCCESS;
+}
+
+// Lays the lines out again around an edit, with a new gap after the
+// inserted lines, and builds the tree from scratch.
+static enum EsError rebuildWrapLines(sWrapLayout *pLayout,
+        unsigned long firstLineIndex, unsigned long removedLines,
+        unsigned long insertedLines) {
+    
+    const unsigned long lines = pLayout->lines - removedLines
+        + insertedLines;
+    const unsigned long tailLines = pLayout->lines - firstLineIndex
+        - removedLines;
+    const unsigned long gapSlots = WRAP_GAP_SLOTS(lines);
+    const unsigned long gapSlot = firstLineIndex + insertedLines;
+    unsigned long slot;
+    
+    if (reserveWrapLines(pLayout, lines + gapSlots) != ES_ERROR_SUCCESS) {
+        return ES_ERROR_ALLOCATION_FAIL;
+        
+    }
+    
+    // Close the old gap, then open the new one.
+    memmove(pLayout->pRowsArr + pLayout->gapLineIndex,
+        pLayout->pRowsArr + pLayout->gapLineIndex + pLayout->gapSlots,
+        sizeof(unsigned long)*(pLayout->lines - pLayout->gapLineIndex));
+    memmove(pLayout->pDirtyArr + pLayout->gapLineIndex,
+        pLayout->pDirtyArr + pLayout->gapLineIndex + pLayout->gapSlots,
+        sizeof(unsigned char)*(pLayout->lines - pLayout->gapLineIndex));
+    memmove(pLayout->pRowsArr + gapSlot + gapSlots,
+        pLayout->pRowsArr + firstLineIndex + removedLines,
+        sizeof(unsigned long)*tailLines);
+    memmove(pLayout->pDirtyArr + gapSlot + gapSlots,
+        pLayout->pDirtyArr + firstLineIndex + removedLines,
+        sizeof(unsigned char)*tailLines);
+    
+    for (slot = firstLineIndex; slot < gapSlot; ++slot) {
+        pLayout->pRowsArr[slot] = 1;
+        pLayout->pDirtyArr[slot] = TRUE;
+    }
+    for (; slot < gapSlot + gapSlots; ++slot) {
+        pLayout->pRowsArr[slot] = 0;
+    }
+    
+    pLayout->lines = lines;
+    pLayout->gapLineIndex = gapSlot;
+    pLayout->gapSlots = gapSlots;
+    buildWrapTree(pLayout);
+    
+    return ES_ERROR_SUCCESS;
+}
+
+// Tells whether updating that many slots one by one costs more than
+// building the tree again.
+static int rebuildCostsLess(const sWrapLayout *pLayout,
+        unsigned long updates) {
+    
+    const unsigned long slots = pLayout->lines + pLayout->gapSlots;
+    unsigned long depth = 1, span;
+    
+    for (span = slots; span > 1; span >>= 1) {
+        ++depth;
+    }
+    
+    return updates > slots / depth;
+}
+
+// Builds the tree from the row counts in linear time. Each node passes
+// its sum up to its parent.
+static void buildWrapTree(sWrapLayout *pLayout) {
+    
+    const unsigned long slots = pLayout->lines + pLayout->gapSlots;
+    unsigned long treeIndex;
+    
+    pLayout->pTreeArr[0] = 0;
+    for (treeIndex = 1; treeIndex <= slots; ++treeIndex) {
+        pLayout->pTreeArr[treeIndex] = pLayout->pRowsArr[treeIndex-1];
+    }
+    for (treeIndex = 1; treeIndex <= slots; ++treeIndex) {
+        const unsigned long parentIndex = treeIndex
+            + LOWEST_BIT(treeIndex);
+        
+        if (parentIndex <= slots) {
+            pLayout->pTreeArr[parentIndex] += pLayout->pTreeArr[treeIndex];
+            
+        }
+    }
+    
+    return;
+}
+
+static void setLineRows(sWrapLayout *pLayout, unsigned long slot,
+        unsigned long rows) {
+    
+    const unsigned long slots = pLayout->lines + pLayout->gapSlots;
+    const unsigned long previousRows = pLayout->pRowsArr[slot];
+    unsigned long treeIndex;
+    
+    if (rows == previousRows) {
+        return;
+        
+    }
+    pLayout->pRowsArr[slot] = rows;
+    
+    // Unsigned arithmetic wraps around, which also subtracts rows.
+    for (treeIndex = slot + 1; treeIndex <= slots;
+            treeIndex += LOWEST_BIT(treeIndex)) {
+        pLayout->pTreeArr[treeIndex] += rows - previousRows;
+    }
+    
+    return;
+}
+
+// Moves the gap before a line. The lines between the old and the new
+// place of the gap move across it, in an order that never overwrites
+// a slot before its line has left.
+static void moveWrapGap(sWrapLayout *pLayout, unsigned long lineIndex) {
+    
+    const unsigned long gapSlots = pLayout->gapSlots;
+    unsigned long slot;
+    
+    if (gapSlots > 0) {
+        for (slot = pLayout->gapLineIndex; slot < lineIndex; ++slot) {
+            moveWrapSlot(pLayout, slot + gapSlots, slot);
+        }
+        for (slot = pLayout->gapLineIndex; slot > lineIndex; --slot) {
+            moveWrapSlot(pLayout, slot - 1, slot - 1 + gapSlots);
+        }
+        
+    }
+    pLayout->gapLineIndex = lineIndex;
+    
+    return;
+}
+
+// Moves the rows of a line into an empty slot.
+static void moveWrapSlot(sWrapLayout *pLayout, unsigned long fromSlot,
+        unsigned long toSlot) {
+    
+    const unsigned long rows = pLayout->pRowsArr[fromSlot];
+    
+    pLayout->pDirtyArr[toSlot] = pLayout->pDirtyArr[fromSlot];
+    setLineRows(pLayout, fromSlot, 0);
+    setLineRows(pLayout, toSlot, rows);
+    
+    return;
+}
+
+// Adds a dirty line of one row. Its tree node holds the rows of the
+// slots that the node covers, which the prefix sums give.
+static void appendWrapLine(sWrapLayout *pLayout) {
+    
+    const unsigned long slot = pLayout->lines + pLayout->gapSlots;
+    const unsigned long treeIndex = slot + 1;
+    
+    pLayout->pRowsArr[slot] = 1;
+    pLayout->pDirtyArr[slot] = TRUE;
+    pLayout->pTreeArr[treeIndex] = 1 + prefixRows(pLayout, slot)
+        - prefixRows(pLayout, treeIndex - LOWEST_BIT(treeIndex));
+    ++(pLayout->lines);
+    
+    return;
+}
+
+static unsigned long slotOfLine(const sWrapLayout *pLayout,
+        unsigned long lineIndex) {
+    
+    return lineIndex < pLayout->gapLineIndex ? lineIndex 
+        : lineIndex + pLayout->gapSlots;
+}
+
+// Sums the rows of the first slots.
+static unsigned long prefixRows(const sWrapLayout *pLayout,
+        unsigned long slots) {
+    
+    unsigned long rows = 0;
+    
+    for (; slots > 0; slots -= LOWEST_BIT(slots)) {
+        rows += pLayout->pTreeArr[slots];
+    }
+    
+    return rows;
+}
@@ -0,0 +1,54 @@
+#include "memory_manager.h"
+
+#ifndef _HEADER_WRAP_LAYOUT
+
+// Rows that soft-wrapped lines occupy on the screen. A Fenwick tree
+// over the row count of each slot converts between visual rows and
+// lines in logarithmic time. Lines start with an estimate of one row
+// and remain dirty until something computes their wrap points. A gap
+// of empty slots without rows moves to where lines come and go, so
+// that edits near each other only update the slots they touch.
+typedef struct WrapLayout {
+    unsigned long lines;
+    unsigned long gapLineIndex;     // Line whose slot follows the gap.
+    unsigned long gapSlots;
+    unsigned long capacity;
+    unsigned short columns;
+    unsigned long *pTreeArr;        // Fenwick tree, indexed from one.
+    unsigned long *pRowsArr;        // Rows of each slot.
+    unsigned char *pDirtyArr;       // Slots with estimated rows.
+} sWrapLayout;
+
+// Lines that a background step resolves at once.
+#define ES_WRAP_RESOLVE_STEP_LINES 256
+
+// Resolves a range of lines in steps, as a task of the scheduler. The
+// task must end before the lines in its range change.
+typedef struct {
+    sWrapLayout *pLayout;
+    const sLineNode *pNode;
+    unsigned long lineIndex;
+    unsigned long lastLineIndex;    // Exclusive.
+} sWrapResolver;
+
+enum EsError constructWrapLayout(sWrapLayout *pLayout, unsigned long lines,
+    unsigned short columns);
+void destructWrapLayout(sWrapLayout *pLayout);
+void resizeWrapLayout(sWrapLayout *pLayout, unsigned short columns);
+enum EsError replaceWrapLines(sWrapLayout *pLayout,
+    unsigned long firstLineIndex, unsigned long removedLines,
+    unsigned long insertedLines);
+void invalidateWrapLines(sWrapLayout *pLayout, unsigned long firstLineIndex,
+    unsigned long lastLineIndex);
+unsigned long resolveWrapLines(sWrapLayout *pLayout,
+    unsigned long lineIndex, const sLineNode *pNode, unsigned long lines);
+int stepWrapResolver(void *pContext);
+unsigned long rowOfLine(const sWrapLayout *pLayout, unsigned long lineIndex);
+unsigned long lineOfRow(const sWrapLayout *pLayout, unsigned long row,
+    unsigned long *pRowInLine);
+unsigned long totalWrapRows(const sWrapLayout *pLayout);
+unsigned int nextWrapBreak(const char *pText, unsigned int characters,
+    unsigned int rowStart, unsigned short columns);
+
+#define _HEADER_WRAP_LAYOUT
+#endif